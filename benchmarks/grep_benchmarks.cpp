@@ -0,0 +1,235 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grep/matcher.hpp"
+#include "grep/scan.hpp"
+#include "grep/static_pattern.hpp"
+
+// corpora are generated from a fixed seed so runs are comparable
+
+// access log style lines (request ids, addresses, status codes, messages)
+std::string make_log_corpus(const std::size_t size) {
+  std::mt19937 random(42);
+  const std::vector<std::string_view> methods{"GET", "POST", "PUT", "DELETE"};
+  const std::vector<std::string_view> words{
+    "user",  "session", "timeout", "cache", "request", "upstream",
+    "retry", "closed",  "token",   "shard", "replica", "commit"};
+  const auto pick = [&random](const auto& items) {
+    return items[random() % items.size()];
+  };
+  std::string corpus;
+  while (corpus.size() < size) {
+    corpus += "id=";
+    for (int i = 0; i < 8; i++) {
+      corpus += "0123456789abcdef"[random() % 16];
+    }
+    corpus += " ip=" + std::to_string(random() % 256) + "."
+            + std::to_string(random() % 256) + "."
+            + std::to_string(random() % 256) + "."
+            + std::to_string(random() % 256);
+    corpus += " ";
+    corpus += pick(methods);
+    corpus += " /api/";
+    corpus += pick(words);
+    corpus += " status=" + std::to_string(pick(std::vector{200, 404, 500}));
+    for (int i = 0, n = static_cast<int>(random() % 8); i < n; i++) {
+      corpus += " ";
+      corpus += pick(words);
+    }
+    if (random() % 1000 == 0) {
+      corpus += " ERROR disk full";
+    }
+    corpus += "\n";
+  }
+  return corpus;
+}
+
+// lines of a single repeated letter, the classic exponential backtracking
+// input for nested quantifiers
+std::string make_pathological_corpus(const std::size_t size) {
+  std::string corpus;
+  while (corpus.size() < size) {
+    corpus += std::string(100, 'a') + "\n";
+  }
+  return corpus;
+}
+
+// example_input.txt repeated to size
+std::string make_example_corpus(const std::size_t size) {
+  std::ifstream file(GREP_EXAMPLE_INPUT);
+  const std::string example{
+    std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+  std::string corpus;
+  while (!example.empty() && corpus.size() < size) {
+    corpus += example;
+  }
+  return corpus;
+}
+
+struct benchmark_case_t {
+  std::string_view name;
+  std::string pattern;
+  const std::string* corpus;
+  bool ignore_case = false;
+};
+
+void scan(
+  benchmark::State& state, const std::string& pattern,
+  const std::string& corpus, const bool ignore_case) {
+  const auto compiled = compile_patterns({pattern}, false, ignore_case);
+  auto scratch = make_match_scratch(compiled);
+  int64_t matched = 0;
+  for (auto _ : state) {
+    scan_buffer(compiled, scratch, corpus, [&matched](std::string_view) {
+      matched++;
+      return true;
+    });
+    benchmark::DoNotOptimize(matched);
+  }
+  state.SetBytesProcessed(
+    static_cast<int64_t>(state.iterations()) * corpus.size());
+  state.counters["lines"] = benchmark::Counter(
+    static_cast<double>(matched) / state.iterations());
+}
+
+void compile(benchmark::State& state, const std::string& pattern) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(compile_patterns({pattern}, false));
+  }
+}
+
+std::vector<std::string_view> split_lines(const std::string& corpus) {
+  std::vector<std::string_view> lines;
+  for (std::size_t begin = 0; begin < corpus.size();) {
+    auto end = corpus.find('\n', begin);
+    end = end == std::string::npos ? corpus.size() : end;
+    lines.emplace_back(corpus.data() + begin, end - begin);
+    begin = end + 1;
+  }
+  return lines;
+}
+
+// calls matcher on one line at a time, the way code embedding a pattern
+// uses it (scan_buffer can skip lines the prefilter rules out)
+template<typename matcher_t>
+void match_lines(
+  benchmark::State& state, const std::vector<std::string_view>& lines,
+  const std::size_t bytes, matcher_t&& matcher) {
+  int64_t matched = 0;
+  for (auto _ : state) {
+    for (const auto line : lines) {
+      matched += matcher(line) ? 1 : 0;
+    }
+    benchmark::DoNotOptimize(matched);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) * bytes);
+  state.counters["lines"] = benchmark::Counter(
+    static_cast<double>(matched) / state.iterations());
+}
+
+// static_pattern_t has its own copy of the grammar and compiler, it must
+// match the same lines as compile_patterns (and the timings only compare
+// when it does)
+template<static_string_t pattern>
+bool engines_agree(const std::vector<std::string_view>& lines) {
+  const auto compiled = compile_patterns({std::string(pattern.view())}, false);
+  auto scratch = make_match_scratch(compiled);
+  for (const auto line : lines) {
+    if (
+      matches(compiled, scratch, line)
+      != static_pattern_t<pattern>::matches(line)) {
+      std::cerr << "static_pattern_t<\"" << pattern.view()
+                << "\"> disagrees with the runtime engine on: " << line
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// the runtime engine and static_pattern_t on the same pattern and lines,
+// exits if they do not agree on every line
+template<static_string_t pattern>
+void register_line_benchmarks(
+  const std::string_view name, const std::string& corpus,
+  const std::vector<std::string_view>& lines) {
+  if (!engines_agree<pattern>(lines)) {
+    std::exit(1);
+  }
+  benchmark::RegisterBenchmark(
+    ("lines/runtime/" + std::string(name)).c_str(),
+    [&corpus, &lines](benchmark::State& state) {
+      const auto compiled =
+        compile_patterns({std::string(pattern.view())}, false);
+      auto scratch = make_match_scratch(compiled);
+      match_lines(
+        state, lines, corpus.size(), [&](const std::string_view line) {
+          return matches(compiled, scratch, line);
+        });
+    })
+    ->Unit(benchmark::kMillisecond);
+  benchmark::RegisterBenchmark(
+    ("lines/static/" + std::string(name)).c_str(),
+    [&corpus, &lines](benchmark::State& state) {
+      match_lines(
+        state, lines, corpus.size(), static_pattern_t<pattern>::matches);
+    })
+    ->Unit(benchmark::kMillisecond);
+}
+
+int main(int argc, char** argv) {
+  constexpr std::size_t corpus_size = 16 << 20;
+  const auto log = make_log_corpus(corpus_size);
+  const auto pathological = make_pathological_corpus(1 << 20);
+  const auto example = make_example_corpus(corpus_size);
+  const std::vector<benchmark_case_t> cases{
+    {"literal", "ERROR", &log},
+    {"literal_miss", "FATAL", &log},
+    {"literal_ignore_case", "error", &log, true},
+    {"literal_miss_ignore_case", "fatal", &log, true},
+    {"class", "id=[0-9a-f]+ ip=\\d+", &log},
+    {"class_run", "[a-z]{12}", &log},
+    {"alternation", "(PUT|DELETE) /api/(token|shard)", &log},
+    {"quantifiers", "ip=\\d+\\.\\d+\\.\\d+\\.\\d+ .* status=5\\d\\d", &log},
+    {"backreference", "(\\w+) \\1", &log},
+    {"pathological", "(a+)+b", &pathological},
+    {"pathological_backreference", "(a*)*\\1b", &pathological},
+    {"example_literal", "parse_pattern", &example},
+    {"example_class", "std::string\\(\"\\w+", &example},
+    {"example_class_ignore_case", "STD::STRING\\(\"\\w+", &example, true},
+  };
+  for (const auto& benchmark_case : cases) {
+    benchmark::RegisterBenchmark(
+      ("scan/" + std::string(benchmark_case.name)).c_str(), scan,
+      benchmark_case.pattern, *benchmark_case.corpus,
+      benchmark_case.ignore_case)
+      ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(
+      ("compile/" + std::string(benchmark_case.name)).c_str(), compile,
+      benchmark_case.pattern)
+      ->Unit(benchmark::kMicrosecond);
+  }
+  const auto log_lines = split_lines(log);
+  const auto example_lines = split_lines(example);
+  register_line_benchmarks<"ERROR">("literal", log, log_lines);
+  register_line_benchmarks<"id=[0-9a-f]+ ip=\\d+">("class", log, log_lines);
+  register_line_benchmarks<"[a-z]{12}">("class_run", log, log_lines);
+  register_line_benchmarks<"(PUT|DELETE) /api/(token|shard)">(
+    "alternation", log, log_lines);
+  register_line_benchmarks<
+    "ip=\\d+\\.\\d+\\.\\d+\\.\\d+ .* status=5\\d\\d">(
+    "quantifiers", log, log_lines);
+  register_line_benchmarks<"std::string\\(\"\\w+">(
+    "example_class", example, example_lines);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
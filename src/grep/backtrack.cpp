@@ -0,0 +1,251 @@
+#include "grep/backtrack.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+namespace {
+
+void clear_backtrack_memo(backtrack_memo_t& memo) {
+  memo.used = 0;
+  if (++memo.generation == std::numeric_limits<int32_t>::max()) {
+    std::ranges::fill(memo.slots, 0);
+    memo.generation = 1;
+  }
+}
+
+std::size_t backtrack_memo_slot(
+  const backtrack_memo_t& memo, const std::span<const int32_t> key) {
+  uint64_t hash = 0;
+  for (const int32_t k : key) {
+    hash = (hash ^ static_cast<uint32_t>(k)) * 0x9e3779b97f4a7c15;
+  }
+  return (hash >> 32) & (memo.slot_count - 1);
+}
+
+// returns false if the key was already present
+bool insert_backtrack_memo(backtrack_memo_t& memo) {
+  const std::size_t stride = memo.key_size + 1;
+  if (2 * (memo.used + 1) > memo.slot_count) {
+    if (memo.slot_count >= backtrack_memo_t::max_slots) {
+      clear_backtrack_memo(memo);
+    } else {
+      // rehash into a table twice the size
+      auto old_slots = std::exchange(memo.slots, {});
+      const std::size_t old_count = memo.slot_count;
+      memo.slot_count = std::max<std::size_t>(2 * old_count, 1024);
+      memo.slots.assign(memo.slot_count * stride, 0);
+      for (std::size_t i = 0; i < old_count; i++) {
+        const int32_t* old_slot = &old_slots[i * stride];
+        if (old_slot[0] != memo.generation) {
+          continue;
+        }
+        const std::span<const int32_t> key(old_slot + 1, memo.key_size);
+        for (std::size_t j = backtrack_memo_slot(memo, key);;
+             j = (j + 1) & (memo.slot_count - 1)) {
+          if (int32_t* slot = &memo.slots[j * stride];
+              slot[0] != memo.generation) {
+            std::ranges::copy(old_slot, old_slot + stride, slot);
+            break;
+          }
+        }
+      }
+    }
+  }
+  for (std::size_t i = backtrack_memo_slot(memo, memo.key);;
+       i = (i + 1) & (memo.slot_count - 1)) {
+    int32_t* slot = &memo.slots[i * stride];
+    if (slot[0] != memo.generation) {
+      slot[0] = memo.generation;
+      std::ranges::copy(memo.key, slot + 1);
+      memo.used++;
+      return true;
+    }
+    if (std::ranges::equal(memo.key, std::span(slot + 1, memo.key_size))) {
+      return false;
+    }
+  }
+}
+
+bool equal_ignoring_case(const char* a, const char* b, const int length) {
+  for (int i = 0; i < length; i++) {
+    if (ascii_lower(a[i]) != ascii_lower(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int& capture_slot(std::span<capture_span_t> captures, const int slot) {
+  auto& span = captures[slot / 2];
+  return slot % 2 == 0 ? span.start : span.end;
+}
+
+// whether the program matches input starting at start, budget is reduced
+// by the split instructions reached. Counting is compiled out unless
+// collect_stats. When longest every thread is explored and the furthest
+// match end is kept in match_end (a state reached again cannot end further
+// than its first visit did)
+template<bool collect_stats, bool longest>
+backtrack_result_e backtrack_at(
+  const program_t& program, const std::string_view input, const int start,
+  std::span<capture_span_t> captures, backtrack_memo_t& memo,
+  std::vector<backtrack_frame_t>& stack, uint64_t& budget,
+  backtrack_stats_t* stats, int& match_end) {
+  const auto& instructions = program.instructions;
+  const int size = static_cast<int>(input.size());
+  stack.clear();
+  stack.push_back({.pc = 0, .pos = start});
+  while (!stack.empty()) {
+    if constexpr (collect_stats) {
+      stats->max_stack_depth =
+        std::max<uint64_t>(stats->max_stack_depth, stack.size());
+    }
+    auto [pc, pos] = stack.back();
+    stack.pop_back();
+    if (pc < 0) {
+      capture_slot(captures, -pc - 1) = pos;
+      continue;
+    }
+    for (bool failed = false; !failed;) {
+      const auto& instruction = instructions[pc];
+      if constexpr (collect_stats) {
+        stats->steps++;
+      }
+      switch (instruction.op) {
+        case opcode_e::byte:
+        case opcode_e::byte_set:
+        case opcode_e::any:
+          if (
+            pos < size
+            && matches_byte(
+              program, instruction, static_cast<unsigned char>(input[pos]))) {
+            pc++;
+            pos++;
+          } else {
+            failed = true;
+          }
+          break;
+        case opcode_e::split: {
+          if (budget-- == 0) {
+            return backtrack_result_e::over_budget;
+          }
+          // every loop goes through a split so this also ends empty loops
+          memo.key.clear();
+          memo.key.push_back(pc);
+          memo.key.push_back(pos);
+          for (const int index : program.referenced_captures) {
+            memo.key.push_back(captures[index].start);
+            memo.key.push_back(captures[index].end);
+          }
+          if (!insert_backtrack_memo(memo)) {
+            if constexpr (collect_stats) {
+              stats->memo_hits++;
+            }
+            failed = true;
+            break;
+          }
+          stack.push_back({.pc = instruction.y, .pos = pos});
+          pc = instruction.x;
+          break;
+        }
+        case opcode_e::jump:
+          pc = instruction.x;
+          break;
+        case opcode_e::save: {
+          int& slot = capture_slot(captures, instruction.x);
+          stack.push_back({.pc = -instruction.x - 1, .pos = slot});
+          slot = pos;
+          pc++;
+          break;
+        }
+        case opcode_e::begin:
+          failed = pos != 0;
+          pc++;
+          break;
+        case opcode_e::end:
+          failed = pos != size;
+          pc++;
+          break;
+        case opcode_e::backref: {
+          if (instruction.x >= program.capture_count) {
+            failed = true;
+            break;
+          }
+          // the captured text is compared in place
+          const auto& span = captures[instruction.x];
+          const int length = span.end - span.start;
+          if (span.start < 0 || length < 0) {
+            failed = true;
+            break;
+          }
+          const char* captured = input.data() + span.start;
+          if (
+            length > size - pos
+            || (instruction.arg != 0
+                  ? !equal_ignoring_case(input.data() + pos, captured, length)
+                  : std::memcmp(input.data() + pos, captured, length) != 0)) {
+            failed = true;
+            break;
+          }
+          pc++;
+          pos += length;
+          break;
+        }
+        case opcode_e::match:
+          if constexpr (!longest) {
+            return backtrack_result_e::match;
+          }
+          match_end = std::max(match_end, pos);
+          failed = true;
+          break;
+      }
+    }
+  }
+  return match_end >= 0 ? backtrack_result_e::match
+                        : backtrack_result_e::no_match;
+}
+
+} // namespace
+
+// whether the program matches anywhere in input, no match may start before
+// input_pos. Gives up once budget split instructions have been reached (0
+// for no limit). stats is added to if not null. If longest_match is not
+// null the longest match starting where the first match starts is stored
+// in it
+backtrack_result_e backtrack_search(
+  const program_t& program, const std::string_view input,
+  const std::string_view::size_type input_pos,
+  std::span<capture_span_t> captures, backtrack_memo_t& memo,
+  std::vector<backtrack_frame_t>& stack, uint64_t budget,
+  backtrack_stats_t* stats, capture_span_t* longest_match) {
+  assert(memo.key_size == 2 + 2 * program.referenced_captures.size());
+  clear_backtrack_memo(memo);
+  std::ranges::fill(captures, capture_span_t{});
+  if (budget == 0) {
+    budget = std::numeric_limits<uint64_t>::max();
+  }
+  const bool longest = longest_match != nullptr;
+  auto backtrack = longest ? backtrack_at<false, true>
+                           : backtrack_at<false, false>;
+  if (stats != nullptr) {
+    backtrack = longest ? backtrack_at<true, true> : backtrack_at<true, false>;
+  }
+  // states visited from earlier start positions are still failures as the
+  // captures they depend on are part of the key
+  for (auto start = input_pos; start <= input.size(); start++) {
+    int match_end = -1;
+    if (const auto result = backtrack(
+          program, input, static_cast<int>(start), captures, memo, stack,
+          budget, stats, match_end);
+        result != backtrack_result_e::no_match) {
+      if (longest && result == backtrack_result_e::match) {
+        *longest_match = {.start = static_cast<int>(start), .end = match_end};
+      }
+      return result;
+    }
+  }
+  return backtrack_result_e::no_match;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "grep/program.hpp"
+
+// backtracking engine, used for programs with backreferences as automata
+// cannot match them. Threads are explored depth first in priority order so
+// reaching a state (split instruction, input position and the spans of the
+// groups backreferences refer to) a second time means the first visit failed
+// (a match ends the search). Each state is therefore explored once, which
+// bounds the work per input
+
+// the input offsets a capture group last matched, unset (-1) until it has
+// matched, backreferences to an unset group fail
+struct capture_span_t {
+  int start = -1;
+  int end = -1;
+};
+
+// states visited while matching one input, cleared in constant time
+struct backtrack_memo_t {
+  // the table is cleared when full so memory stays bounded (states may then
+  // be explored again, which costs time but not correctness)
+  static constexpr std::size_t max_slots = 1 << 20;
+
+  // ints per key: pc, input position and two per referenced capture group
+  std::size_t key_size = 0;
+  // per slot the generation that filled it followed by the key
+  std::vector<int32_t> slots;
+  std::size_t slot_count = 0;
+  std::size_t used = 0;
+  int32_t generation = 0;
+  std::vector<int32_t> key;
+};
+
+// split instructions (the only way to loop, so a bound on the work) the
+// engine may reach on one input before giving up on it, a fraction of a
+// second of work
+constexpr uint64_t default_backtrack_budget = 1 << 20;
+
+enum class backtrack_result_e { no_match, match, over_budget };
+
+// work done by the backtracking engine, collected only when asked for
+struct backtrack_stats_t {
+  // instructions executed
+  uint64_t steps = 0;
+  // states not explored again as they had already failed
+  uint64_t memo_hits = 0;
+  // deepest the stack of threads to resume grew
+  uint64_t max_stack_depth = 0;
+};
+
+// a thread to resume (pc >= 0) or a capture slot to restore when
+// backtracking past the save that changed it (slot -pc - 1)
+struct backtrack_frame_t {
+  int pc;
+  int pos;
+};
+
+// whether the program matches anywhere in input, no match may start before
+// input_pos. Gives up once budget split instructions have been reached (0
+// for no limit). stats is added to if not null. If longest_match is not
+// null the longest match starting where the first match starts is stored
+// in it
+backtrack_result_e backtrack_search(
+  const program_t& program, std::string_view input,
+  std::string_view::size_type input_pos,
+  std::span<capture_span_t> captures, backtrack_memo_t& memo,
+  std::vector<backtrack_frame_t>& stack, uint64_t budget,
+  backtrack_stats_t* stats, capture_span_t* longest_match = nullptr);
@@ -0,0 +1,222 @@
+#include "grep/byte_set.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GREP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+const byte_set_t& digit_byte_set() {
+  static const byte_set_t byte_set = [] {
+    byte_set_t byte_set;
+    for (int c = '0'; c <= '9'; c++) {
+      byte_set.set(c);
+    }
+    return byte_set;
+  }();
+  return byte_set;
+}
+
+const byte_set_t& word_byte_set() {
+  static const byte_set_t byte_set = [] {
+    byte_set_t byte_set = digit_byte_set();
+    for (int c = 'a'; c <= 'z'; c++) {
+      byte_set.set(c);
+      byte_set.set(c - 'a' + 'A');
+    }
+    byte_set.set('_');
+    return byte_set;
+  }();
+  return byte_set;
+}
+
+byte_set_t fold_case(const byte_set_t& byte_set) {
+  byte_set_t folded = byte_set;
+  for (int c = 'a'; c <= 'z'; c++) {
+    if (byte_set[c] || byte_set[c - 'a' + 'A']) {
+      folded.set(c);
+      folded.set(c - 'a' + 'A');
+    }
+  }
+  return folded;
+}
+
+byte_scanner_t make_byte_scanner(const byte_set_t& byte_set) {
+  byte_scanner_t scanner{.byte_set = byte_set, .count = byte_set.count()};
+  for (int c = 0; c < 256; c++) {
+    if (!byte_set[c]) {
+      continue;
+    }
+    scanner.single = static_cast<char>(c);
+    auto& low_nibbles =
+      c < 0x80 ? scanner.low_nibbles_ascii : scanner.low_nibbles_high;
+    low_nibbles[c & 0xf] |= 1 << ((c >> 4) & 0x7);
+  }
+  return scanner;
+}
+
+namespace {
+
+const char* find_byte_scalar(
+  const byte_scanner_t& scanner, const char* begin, const char* const end) {
+  for (; begin != end; ++begin) {
+    if (scanner.byte_set[static_cast<unsigned char>(*begin)]) {
+      return begin;
+    }
+  }
+  return end;
+}
+
+#if defined(GREP_X86_SIMD)
+__attribute__((target("ssse3"))) const char* find_byte_ssse3(
+  const byte_scanner_t& scanner, const char* begin, const char* const end) {
+  const auto ascii = _mm_load_si128(
+    reinterpret_cast<const __m128i*>(scanner.low_nibbles_ascii.data()));
+  const auto high = _mm_load_si128(
+    reinterpret_cast<const __m128i*>(scanner.low_nibbles_high.data()));
+  const auto bits =
+    _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const auto high_bit = _mm_set1_epi8(static_cast<char>(0x80));
+  const auto low_bits = _mm_set1_epi8(0x7);
+  for (; end - begin >= 16; begin += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    // shuffles give zero for indices with the top bit set, so each table
+    // only answers for its half of the byte values
+    const auto lookup = _mm_or_si128(
+      _mm_shuffle_epi8(ascii, v),
+      _mm_shuffle_epi8(high, _mm_xor_si128(v, high_bit)));
+    const auto bit = _mm_shuffle_epi8(
+      bits, _mm_and_si128(_mm_srli_epi16(v, 4), low_bits));
+    const auto hits = _mm_cmpeq_epi8(_mm_and_si128(lookup, bit), bit);
+    if (const int mask = _mm_movemask_epi8(hits); mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_byte_scalar(scanner, begin, end);
+}
+
+__attribute__((target("avx2"))) const char* find_byte_avx2(
+  const byte_scanner_t& scanner, const char* begin, const char* const end) {
+  const auto ascii = _mm256_broadcastsi128_si256(_mm_load_si128(
+    reinterpret_cast<const __m128i*>(scanner.low_nibbles_ascii.data())));
+  const auto high = _mm256_broadcastsi128_si256(_mm_load_si128(
+    reinterpret_cast<const __m128i*>(scanner.low_nibbles_high.data())));
+  const auto bits = _mm256_broadcastsi128_si256(
+    _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128));
+  const auto high_bit = _mm256_set1_epi8(static_cast<char>(0x80));
+  const auto low_bits = _mm256_set1_epi8(0x7);
+  for (; end - begin >= 32; begin += 32) {
+    const auto v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    const auto lookup = _mm256_or_si256(
+      _mm256_shuffle_epi8(ascii, v),
+      _mm256_shuffle_epi8(high, _mm256_xor_si256(v, high_bit)));
+    const auto bit = _mm256_shuffle_epi8(
+      bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_bits));
+    const auto hits = _mm256_cmpeq_epi8(_mm256_and_si256(lookup, bit), bit);
+    if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+  return find_byte_ssse3(scanner, begin, end);
+}
+#endif
+
+std::size_t count_byte_scalar(
+  const char c, const char* const begin, const char* const end) {
+  return std::count(begin, end, c);
+}
+
+#if defined(GREP_X86_SIMD)
+// lanes count matches by subtracting the all ones compare result, and are
+// summed every 255 blocks before they can overflow
+std::size_t count_byte_sse2(
+  const char c, const char* begin, const char* const end) {
+  const auto needle = _mm_set1_epi8(c);
+  std::size_t count = 0;
+  while (end - begin >= 16) {
+    const auto blocks = std::min<std::ptrdiff_t>((end - begin) / 16, 255);
+    auto lanes = _mm_setzero_si128();
+    for (std::ptrdiff_t i = 0; i < blocks; i++, begin += 16) {
+      const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+      lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(v, needle));
+    }
+    const auto sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+    count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+  }
+  return count + count_byte_scalar(c, begin, end);
+}
+
+__attribute__((target("avx2"))) std::size_t count_byte_avx2(
+  const char c, const char* begin, const char* const end) {
+  const auto needle = _mm256_set1_epi8(c);
+  std::size_t count = 0;
+  while (end - begin >= 32) {
+    const auto blocks = std::min<std::ptrdiff_t>((end - begin) / 32, 255);
+    auto lanes = _mm256_setzero_si256();
+    for (std::ptrdiff_t i = 0; i < blocks; i++, begin += 32) {
+      const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+      lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(v, needle));
+    }
+    const auto sums = _mm256_sad_epu8(lanes, _mm256_setzero_si256());
+    count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+           + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+  }
+  return count + count_byte_sse2(c, begin, end);
+}
+#endif
+
+using count_byte_fn_t = std::size_t (*)(char, const char*, const char*);
+
+count_byte_fn_t select_count_byte() {
+#if defined(GREP_X86_SIMD)
+  if (__builtin_cpu_supports("avx2")) {
+    return count_byte_avx2;
+  }
+  return count_byte_sse2;
+#else
+  return count_byte_scalar;
+#endif
+}
+
+using find_byte_fn_t =
+  const char* (*)(const byte_scanner_t&, const char*, const char*);
+
+find_byte_fn_t select_find_byte() {
+#if defined(GREP_X86_SIMD)
+  if (__builtin_cpu_supports("avx2")) {
+    return find_byte_avx2;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    return find_byte_ssse3;
+  }
+#endif
+  return find_byte_scalar;
+}
+
+} // namespace
+
+// returns end if no byte in [begin, end) belongs to the set
+const char* find_byte(
+  const byte_scanner_t& scanner, const char* const begin,
+  const char* const end) {
+  static const find_byte_fn_t find_byte_fn = select_find_byte();
+  if (scanner.count == 1) {
+    const void* found = std::memchr(begin, scanner.single, end - begin);
+    return found != nullptr ? static_cast<const char*>(found) : end;
+  }
+  if (scanner.count == 0) {
+    return end;
+  }
+  return find_byte_fn(scanner, begin, end);
+}
+
+std::size_t count_byte(
+  const char c, const char* const begin, const char* const end) {
+  static const count_byte_fn_t count_byte_fn = select_count_byte();
+  return count_byte_fn(c, begin, end);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+// lookup table with one bit per byte value
+using byte_set_t = std::bitset<256>;
+
+// \d and \w, independent of the locale
+const byte_set_t& digit_byte_set();
+const byte_set_t& word_byte_set();
+
+// case is only folded for ASCII letters
+constexpr bool is_ascii_letter(const char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr char ascii_lower(const char c) {
+  return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// byte_set with both cases of every letter in it
+byte_set_t fold_case(const byte_set_t& byte_set);
+
+// finds the next byte belonging to a set. A single byte uses memchr, other
+// sets use a nibble lookup (two table shuffles per 16 or 32 input bytes)
+// when the cpu has SSSE3 or AVX2 and a scalar table lookup otherwise
+struct byte_scanner_t {
+  byte_set_t byte_set;
+  std::size_t count = 0;
+  // the byte when count is 1
+  char single = 0;
+  // entry c & 15 has bit (c >> 4) & 7 set for every byte c in the set, for
+  // bytes below 0x80 and from 0x80 respectively
+  alignas(16) std::array<uint8_t, 16> low_nibbles_ascii{};
+  alignas(16) std::array<uint8_t, 16> low_nibbles_high{};
+};
+
+byte_scanner_t make_byte_scanner(const byte_set_t& byte_set);
+
+// returns end if no byte in [begin, end) belongs to the set
+const char* find_byte(
+  const byte_scanner_t& scanner, const char* begin,
+  const char* end);
+
+// occurrences of c in [begin, end), 16 or 32 bytes at a time with SSE2 or
+// AVX2
+std::size_t count_byte(char c, const char* begin, const char* end);
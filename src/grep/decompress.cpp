@@ -0,0 +1,366 @@
+#include "grep/decompress.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#if defined(GREP_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(GREP_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace {
+
+// output is handed over in blocks of this size, of which there are a fixed
+// few so the thread only runs this far ahead of the reader
+constexpr std::size_t block_size = 256 << 10;
+constexpr std::size_t block_count = 4;
+// compressed bytes read from fd at once
+constexpr std::size_t input_size = 128 << 10;
+
+struct block_t {
+  std::unique_ptr<char[]> data;
+  std::size_t size = 0;
+};
+
+} // namespace
+
+struct decompress_stream_t::state_t {
+  compression_e compression;
+  // compressed bytes before those read from fd
+  std::string_view input;
+  int fd;
+  std::vector<char> input_buffer;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<block_t> free;
+  // filled blocks in order
+  std::deque<block_t> ready;
+  // no more blocks are coming
+  bool finished = false;
+  bool failed = false;
+  bool stopping = false;
+  // the block being read and how much of it has been, only used by the
+  // reader
+  block_t current;
+  std::size_t read_offset = 0;
+  std::thread thread;
+};
+
+namespace {
+
+using state_t = decompress_stream_t::state_t;
+
+// the next compressed bytes, empty at the end of the input. Returns false
+// if reading failed
+bool next_input(state_t& state, std::string_view& chunk) {
+  if (!state.input.empty()) {
+    chunk = state.input;
+    state.input = {};
+    return true;
+  }
+  chunk = {};
+  if (state.fd < 0) {
+    return true;
+  }
+  for (;;) {
+    const auto bytes_read =
+      read(state.fd, state.input_buffer.data(), state.input_buffer.size());
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0) {
+      return false;
+    }
+    chunk = {state.input_buffer.data(), static_cast<std::size_t>(bytes_read)};
+    return true;
+  }
+}
+
+void hand_over(state_t& state, block_t& block) {
+  {
+    std::lock_guard lock(state.mutex);
+    if (block.size > 0) {
+      state.ready.push_back(std::move(block));
+    } else if (block.data) {
+      state.free.push_back(std::move(block));
+    }
+  }
+  block = {};
+  state.changed.notify_all();
+}
+
+// makes sure block has room for output, handing it over once full and
+// waiting for a free one. Returns false if the stream is being destroyed
+bool make_room(state_t& state, block_t& block) {
+  if (block.data && block.size < block_size) {
+    return true;
+  }
+  if (block.data) {
+    hand_over(state, block);
+  }
+  std::unique_lock lock(state.mutex);
+  state.changed.wait(
+    lock, [&state] { return state.stopping || !state.free.empty(); });
+  if (state.stopping) {
+    return false;
+  }
+  block = std::move(state.free.front());
+  state.free.pop_front();
+  block.size = 0;
+  return true;
+}
+
+// the limit on the bytes passed to the libraries at once, which count them
+// in 32 bits
+constexpr std::size_t max_step = 1 << 30;
+
+#if defined(GREP_HAVE_ZLIB)
+
+// each of the decompressors fills block (handed over by the caller) and
+// returns false if the input is corrupt or truncated. gzip files may be
+// several members one after another, then padding
+bool inflate_gzip(state_t& state, block_t& block) {
+  z_stream stream{};
+  // 32 for a gzip (or zlib) header
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return false;
+  }
+  const std::unique_ptr<z_stream, int (*)(z_stream*)> end(&stream, inflateEnd);
+  std::string_view in;
+  bool in_member = false;
+  // the last call filled the block, more output may be pending
+  bool flushing = false;
+  for (;;) {
+    if (in.empty() && !flushing) {
+      if (!next_input(state, in)) {
+        return false;
+      }
+      if (in.empty()) {
+        return !in_member;
+      }
+    }
+    if (!in_member && !in.empty()) {
+      // like gzip, bytes after the last member that do not start another
+      // (such as zero padding) are ignored
+      if (in[0] != '\x1f' || (in.size() > 1 && in[1] != '\x8b')) {
+        return true;
+      }
+      inflateReset(&stream);
+      in_member = true;
+    }
+    if (!make_room(state, block)) {
+      return true;
+    }
+    const auto in_size = std::min(in.size(), max_step);
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    stream.avail_in = static_cast<uInt>(in_size);
+    stream.next_out = reinterpret_cast<Bytef*>(block.data.get() + block.size);
+    stream.avail_out = static_cast<uInt>(block_size - block.size);
+    const int result = inflate(&stream, Z_NO_FLUSH);
+    in.remove_prefix(in_size - stream.avail_in);
+    block.size = block_size - stream.avail_out;
+    flushing = stream.avail_out == 0;
+    if (result == Z_STREAM_END) {
+      in_member = false;
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      return false;
+    }
+  }
+}
+
+#endif
+
+#if defined(GREP_HAVE_ZSTD)
+
+// a file may be several frames, which the context decompresses in turn
+bool decompress_zstd(state_t& state, block_t& block) {
+  const std::unique_ptr<ZSTD_DCtx, std::size_t (*)(ZSTD_DCtx*)> context(
+    ZSTD_createDCtx(), ZSTD_freeDCtx);
+  if (!context) {
+    return false;
+  }
+  std::string_view in;
+  // 0 once a frame is complete
+  std::size_t frame_left = 0;
+  bool flushing = false;
+  for (;;) {
+    if (in.empty() && !flushing) {
+      if (!next_input(state, in)) {
+        return false;
+      }
+      if (in.empty()) {
+        return frame_left == 0;
+      }
+    }
+    if (!make_room(state, block)) {
+      return true;
+    }
+    ZSTD_inBuffer input{in.data(), std::min(in.size(), max_step), 0};
+    ZSTD_outBuffer output{
+      block.data.get() + block.size, block_size - block.size, 0};
+    frame_left = ZSTD_decompressStream(context.get(), &output, &input);
+    if (ZSTD_isError(frame_left)) {
+      return false;
+    }
+    in.remove_prefix(input.pos);
+    block.size += output.pos;
+    flushing = output.pos == output.size;
+  }
+}
+
+#endif
+
+void decompress(state_t& state) {
+  block_t block;
+  bool decompressed = false;
+  switch (state.compression) {
+    case compression_e::gzip:
+#if defined(GREP_HAVE_ZLIB)
+      decompressed = inflate_gzip(state, block);
+#endif
+      break;
+    case compression_e::zstd:
+#if defined(GREP_HAVE_ZSTD)
+      decompressed = decompress_zstd(state, block);
+#endif
+      break;
+    case compression_e::none:
+      break;
+  }
+  hand_over(state, block);
+  {
+    std::lock_guard lock(state.mutex);
+    state.finished = true;
+    state.failed = !decompressed;
+  }
+  state.changed.notify_all();
+}
+
+// makes current a block with output left to read, waiting for one. False
+// at the end
+bool next_ready(state_t& state) {
+  if (state.read_offset < state.current.size) {
+    return true;
+  }
+  std::unique_lock lock(state.mutex);
+  if (state.current.data) {
+    state.free.push_back(std::move(state.current));
+    state.current = {};
+    state.changed.notify_all();
+  }
+  state.changed.wait(
+    lock, [&state] { return state.finished || !state.ready.empty(); });
+  if (state.ready.empty()) {
+    return false;
+  }
+  state.current = std::move(state.ready.front());
+  state.ready.pop_front();
+  state.read_offset = 0;
+  return true;
+}
+
+} // namespace
+
+compression_e detect_compression(const std::string_view start) {
+  if (start.starts_with("\x1f\x8b")) {
+    return compression_e::gzip;
+  }
+  if (start.starts_with("\x28\xb5\x2f\xfd")) {
+    return compression_e::zstd;
+  }
+  return compression_e::none;
+}
+
+bool can_decompress(const compression_e compression) {
+  switch (compression) {
+    case compression_e::gzip:
+#if defined(GREP_HAVE_ZLIB)
+      return true;
+#else
+      return false;
+#endif
+    case compression_e::zstd:
+#if defined(GREP_HAVE_ZSTD)
+      return true;
+#else
+      return false;
+#endif
+    case compression_e::none:
+      break;
+  }
+  return false;
+}
+
+decompress_stream_t::decompress_stream_t(std::unique_ptr<state_t> state)
+  : state(std::move(state)) {
+}
+
+decompress_stream_t::~decompress_stream_t() {
+  {
+    std::lock_guard lock(state->mutex);
+    state->stopping = true;
+  }
+  state->changed.notify_all();
+  state->thread.join();
+}
+
+std::unique_ptr<decompress_stream_t> make_decompress_stream(
+  const compression_e compression, const std::string_view input,
+  const int fd) {
+  if (!can_decompress(compression)) {
+    return nullptr;
+  }
+  auto state = std::make_unique<state_t>();
+  state->compression = compression;
+  state->input = input;
+  state->fd = fd;
+  state->input_buffer.resize(fd >= 0 ? input_size : 0);
+  for (std::size_t i = 0; i < block_count; i++) {
+    state->free.push_back(
+      {.data = std::make_unique_for_overwrite<char[]>(block_size)});
+  }
+  state->thread = std::thread([&state = *state] { decompress(state); });
+  return std::make_unique<decompress_stream_t>(std::move(state));
+}
+
+ssize_t read_decompressed(
+  decompress_stream_t& stream, char* data, const std::size_t size) {
+  auto& state = *stream.state;
+  if (!next_ready(state)) {
+    if (decompress_failed(stream)) {
+      errno = EIO;
+      return -1;
+    }
+    return 0;
+  }
+  const auto count = std::min(size, state.current.size - state.read_offset);
+  std::memcpy(data, state.current.data.get() + state.read_offset, count);
+  state.read_offset += count;
+  return static_cast<ssize_t>(count);
+}
+
+std::string_view peek_decompressed(decompress_stream_t& stream) {
+  auto& state = *stream.state;
+  if (!next_ready(state)) {
+    return {};
+  }
+  return {
+    state.current.data.get() + state.read_offset,
+    state.current.size - state.read_offset};
+}
+
+bool decompress_failed(decompress_stream_t& stream) {
+  std::lock_guard lock(stream.state->mutex);
+  return stream.state->failed;
+}
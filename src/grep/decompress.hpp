@@ -0,0 +1,56 @@
+#pragma once
+
+// decompresses gzip and zstd input on a thread of its own, so inflating
+// overlaps with matching, into a fixed few blocks that are reused. Memory
+// use does not depend on the size of the output. Each format is only
+// supported if its library (zlib, zstd) was found when building
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+#include <sys/types.h>
+
+enum class compression_e { none, gzip, zstd };
+
+// bytes detect_compression needs to see
+constexpr std::size_t compression_magic_size = 4;
+
+// from the magic bytes at the start of the input
+compression_e detect_compression(std::string_view start);
+
+// false for formats whose library was not built in
+bool can_decompress(compression_e compression);
+
+struct decompress_stream_t {
+  // shared with the decompressing thread, defined with it
+  struct state_t;
+
+  std::unique_ptr<state_t> state;
+
+  explicit decompress_stream_t(std::unique_ptr<state_t> state);
+  decompress_stream_t(const decompress_stream_t&) = delete;
+  decompress_stream_t& operator=(const decompress_stream_t&) = delete;
+  // stops decompressing and waits for the thread (which may first finish
+  // a read of fd)
+  ~decompress_stream_t();
+};
+
+// decompresses input followed by what is read from fd (if it is not -1),
+// both must stay valid while the stream is. nullptr if compression cannot
+// be decompressed
+std::unique_ptr<decompress_stream_t> make_decompress_stream(
+  compression_e compression, std::string_view input, int fd);
+
+// copies up to size bytes of output like read(2), waiting for them: 0 at
+// the end, -1 (errno is EIO) once the output before the input turned out
+// to be corrupt or could not be read has been read
+ssize_t read_decompressed(
+  decompress_stream_t& stream, char* data, std::size_t size);
+
+// the output the next read starts with (up to the end of a block), waiting
+// for it, empty at the end
+std::string_view peek_decompressed(decompress_stream_t& stream);
+
+// true once reading has ended early as the input was corrupt
+bool decompress_failed(decompress_stream_t& stream);
@@ -0,0 +1,258 @@
+#include "grep/dfa.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+void program_closure(
+  lazy_dfa_t& dfa, std::vector<int>& set, const bool at_begin,
+  const bool at_end) {
+  const auto& instructions = dfa.program->instructions;
+  if (dfa.visited.size() != instructions.size()) {
+    dfa.visited.assign(instructions.size(), 0);
+    dfa.visit_generation = 0;
+  }
+  if (++dfa.visit_generation == 0) {
+    std::ranges::fill(dfa.visited, 0);
+    dfa.visit_generation = 1;
+  }
+  dfa.stack.assign(set.begin(), set.end());
+  set.clear();
+  while (!dfa.stack.empty()) {
+    const int pc = dfa.stack.back();
+    dfa.stack.pop_back();
+    if (dfa.visited[pc] == dfa.visit_generation) {
+      continue;
+    }
+    dfa.visited[pc] = dfa.visit_generation;
+    const auto& instruction = instructions[pc];
+    switch (instruction.op) {
+      case opcode_e::split:
+        dfa.stack.push_back(instruction.y);
+        dfa.stack.push_back(instruction.x);
+        break;
+      case opcode_e::jump:
+        dfa.stack.push_back(instruction.x);
+        break;
+      case opcode_e::save:
+        dfa.stack.push_back(pc + 1);
+        break;
+      case opcode_e::begin:
+        if (at_begin) {
+          dfa.stack.push_back(pc + 1);
+        }
+        break;
+      case opcode_e::end:
+        if (at_end) {
+          dfa.stack.push_back(pc + 1);
+        } else {
+          set.push_back(pc);
+        }
+        break;
+      case opcode_e::byte:
+      case opcode_e::byte_set:
+      case opcode_e::any:
+      case opcode_e::match:
+        set.push_back(pc);
+        break;
+      case opcode_e::backref:
+        // programs with backreferences never get a dfa
+        std::unreachable();
+    }
+  }
+  std::ranges::sort(set);
+}
+
+int add_dfa_state(lazy_dfa_t& dfa, std::vector<int> set) {
+  if (auto it = dfa.state_ids.find(set); it != dfa.state_ids.end()) {
+    return it->second;
+  }
+  const auto& instructions = dfa.program->instructions;
+  uint8_t flags = 0;
+  std::vector<int> at_end;
+  for (const int pc : set) {
+    if (instructions[pc].op == opcode_e::match) {
+      flags |= lazy_dfa_t::flags_e::match | lazy_dfa_t::flags_e::match_at_end;
+    } else if (instructions[pc].op == opcode_e::end) {
+      at_end.push_back(pc);
+    }
+  }
+  if (!at_end.empty()) {
+    program_closure(dfa, at_end, false, true);
+    if (std::ranges::any_of(at_end, [&instructions](const int pc) {
+          return instructions[pc].op == opcode_e::match;
+        })) {
+      flags |= lazy_dfa_t::flags_e::match_at_end;
+    }
+  }
+  const int id = static_cast<int>(dfa.state_sets.size());
+  dfa.state_ids.emplace(set, id);
+  dfa.state_sets.push_back(std::move(set));
+  dfa.transitions.resize(dfa.transitions.size() + 256, lazy_dfa_t::unknown);
+  dfa.flags.push_back(flags);
+  dfa.accelerator_ids.push_back(lazy_dfa_t::unknown);
+  return id;
+}
+
+void reset_dfa(lazy_dfa_t& dfa) {
+  dfa.state_sets.clear();
+  dfa.state_ids.clear();
+  dfa.transitions.clear();
+  dfa.flags.clear();
+  dfa.accelerator_ids.clear();
+  dfa.accelerators.clear();
+  add_dfa_state(dfa, {}); // dead
+  std::vector<int> set{0};
+  program_closure(dfa, set, true, false);
+  dfa.begin_start = add_dfa_state(dfa, std::move(set));
+  set = {0};
+  program_closure(dfa, set, false, false);
+  dfa.mid_start = add_dfa_state(dfa, std::move(set));
+}
+
+// program counters reached from state on c, without adding a dfa state
+std::vector<int> dfa_step(
+  lazy_dfa_t& dfa, const int state, const unsigned char c) {
+  const auto& program = *dfa.program;
+  std::vector<int> next;
+  for (const int pc : dfa.state_sets[state]) {
+    if (matches_byte(program, program.instructions[pc], c)) {
+      next.push_back(pc + 1);
+    }
+  }
+  if (dfa.unanchored) {
+    next.push_back(0);
+  }
+  program_closure(dfa, next, false, false);
+  return next;
+}
+
+int compute_dfa_transition(lazy_dfa_t& dfa, int state, const unsigned char c) {
+  auto next = dfa_step(dfa, state, c);
+  if (dfa.state_sets.size() >= lazy_dfa_t::max_states) {
+    // keep the source state so its transition can still be recorded
+    auto current = dfa.state_sets[state];
+    reset_dfa(dfa);
+    dfa.flushes++;
+    state = add_dfa_state(dfa, std::move(current));
+  }
+  const int target = add_dfa_state(dfa, std::move(next));
+  dfa.transitions[state * 256 + c] = target;
+  return target;
+}
+
+inline int dfa_next(lazy_dfa_t& dfa, const int state, const unsigned char c) {
+  const int next = dfa.transitions[state * 256 + c];
+  return next != lazy_dfa_t::unknown ? next
+                                     : compute_dfa_transition(dfa, state, c);
+}
+
+// the bytes leaving a state that stays put on every other byte (such as
+// the loop of [a-z]+), nullptr when every byte leaves it
+const byte_scanner_t* dfa_accelerator(lazy_dfa_t& dfa, const int state) {
+  if (dfa.accelerator_ids[state] == lazy_dfa_t::unknown) {
+    // sets are compared rather than states so no state is added and the
+    // cache cannot be flushed under the caller
+    byte_set_t escapes;
+    for (int c = 0; c < 256; c++) {
+      const int next = dfa.transitions[state * 256 + c];
+      if (
+        next != lazy_dfa_t::unknown
+          ? next != state
+          : dfa_step(dfa, state, c) != dfa.state_sets[state]) {
+        escapes.set(c);
+      }
+    }
+    if (escapes.all()) {
+      dfa.accelerator_ids[state] = lazy_dfa_t::no_accelerator;
+    } else {
+      dfa.accelerator_ids[state] = static_cast<int>(dfa.accelerators.size());
+      dfa.accelerators.push_back(make_byte_scanner(escapes));
+    }
+  }
+  const int id = dfa.accelerator_ids[state];
+  return id != lazy_dfa_t::no_accelerator ? &dfa.accelerators[id] : nullptr;
+}
+
+} // namespace
+
+lazy_dfa_t make_lazy_dfa(
+  std::shared_ptr<const program_t> program, const bool unanchored) {
+  lazy_dfa_t dfa;
+  dfa.program = std::move(program);
+  dfa.unanchored = unanchored;
+  reset_dfa(dfa);
+  return dfa;
+}
+
+// returns true if the pattern matches anywhere in input, no match may start
+// before input_pos. first_bytes (a superset of the bytes a match can start
+// with) lets an unanchored automaton skip ahead while no match is underway
+bool dfa_search(
+  lazy_dfa_t& dfa, const std::string_view input,
+  const std::string_view::size_type input_pos,
+  const byte_scanner_t* first_bytes) {
+  return dfa_first_match_end(dfa, input, input_pos, first_bytes)
+      != std::string_view::npos;
+}
+
+std::string_view::size_type dfa_first_match_end(
+  lazy_dfa_t& dfa, const std::string_view input,
+  const std::string_view::size_type input_pos,
+  const byte_scanner_t* first_bytes) {
+  int state = input_pos == 0 ? dfa.begin_start : dfa.mid_start;
+  if ((dfa.flags[state] & lazy_dfa_t::flags_e::match) != 0) {
+    return input_pos;
+  }
+  const char* pos = input.data() + input_pos;
+  const char* const end = input.data() + input.size();
+  int self_transitions = 0;
+  while (pos != end) {
+    if (first_bytes != nullptr && dfa.unanchored && state == dfa.mid_start) {
+      if ((pos = find_byte(*first_bytes, pos, end)) == end) {
+        break;
+      }
+    } else if (self_transitions >= lazy_dfa_t::accelerate_after) {
+      self_transitions = 0;
+      if (const auto* escapes = dfa_accelerator(dfa, state)) {
+        if ((pos = find_byte(*escapes, pos, end)) == end) {
+          break;
+        }
+      }
+    }
+    const int next = dfa_next(dfa, state, static_cast<unsigned char>(*pos++));
+    if (next == lazy_dfa_t::dead) {
+      return std::string_view::npos;
+    }
+    if ((dfa.flags[next] & lazy_dfa_t::flags_e::match) != 0) {
+      return pos - input.data();
+    }
+    self_transitions = next == state ? self_transitions + 1 : 0;
+    state = next;
+  }
+  return (dfa.flags[state] & lazy_dfa_t::flags_e::match_at_end) != 0
+         ? input.size()
+         : std::string_view::npos;
+}
+
+std::string_view::size_type dfa_longest_match_end(
+  lazy_dfa_t& dfa, const std::string_view input,
+  const std::string_view::size_type input_pos) {
+  int state = input_pos == 0 ? dfa.begin_start : dfa.mid_start;
+  auto longest = (dfa.flags[state] & lazy_dfa_t::flags_e::match) != 0
+                 ? input_pos
+                 : std::string_view::npos;
+  for (auto pos = input_pos; pos < input.size();) {
+    state = dfa_next(dfa, state, static_cast<unsigned char>(input[pos++]));
+    if (state == lazy_dfa_t::dead) {
+      return longest;
+    }
+    if ((dfa.flags[state] & lazy_dfa_t::flags_e::match) != 0) {
+      longest = pos;
+    }
+  }
+  return (dfa.flags[state] & lazy_dfa_t::flags_e::match_at_end) != 0
+         ? input.size()
+         : longest;
+}
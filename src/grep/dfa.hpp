@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+#include "grep/program.hpp"
+
+// automaton engine, used for every program without backreferences so
+// matching a line is linear in its length
+
+// subset construction performed on demand while scanning, states are cached
+// and the cache is flushed if it grows beyond max_states
+struct lazy_dfa_t {
+  static constexpr int dead = 0;
+  static constexpr int unknown = -1;
+  static constexpr int max_states = 4096;
+  // consecutive self transitions before a state is checked for a loop that
+  // can be skipped with find_byte
+  static constexpr int accelerate_after = 16;
+  static constexpr int no_accelerator = -2;
+
+  struct flags_e {
+    enum : uint8_t { match = 1 << 0, match_at_end = 1 << 1 };
+  };
+
+  std::shared_ptr<const program_t> program;
+  // unanchored automata restart the program at every input position
+  bool unanchored = true;
+  // sorted program counters (byte consuming, end and match instructions)
+  // making up each dfa state
+  std::vector<std::vector<int>> state_sets;
+  std::map<std::vector<int>, int> state_ids;
+  std::vector<int> transitions;
+  std::vector<uint8_t> flags;
+  // per state an index into accelerators, unknown or no_accelerator
+  std::vector<int> accelerator_ids;
+  // bytes leaving states that loop on every other byte
+  std::vector<byte_scanner_t> accelerators;
+  // start states for the first input position and for any later position
+  int begin_start = unknown;
+  int mid_start = unknown;
+  // times the cache outgrew max_states
+  uint64_t flushes = 0;
+  // scratch space for computing closures
+  std::vector<uint32_t> visited;
+  uint32_t visit_generation = 0;
+  std::vector<int> stack;
+};
+
+lazy_dfa_t make_lazy_dfa(
+  std::shared_ptr<const program_t> program, bool unanchored);
+
+// returns true if the pattern matches anywhere in input, no match may start
+// before input_pos. first_bytes (a superset of the bytes a match can start
+// with) lets an unanchored automaton skip ahead while no match is underway
+bool dfa_search(
+  lazy_dfa_t& dfa, std::string_view input,
+  std::string_view::size_type input_pos = 0,
+  const byte_scanner_t* first_bytes = nullptr);
+
+// dfa_search returning where the match ending first ends, npos if none
+std::string_view::size_type dfa_first_match_end(
+  lazy_dfa_t& dfa, std::string_view input,
+  std::string_view::size_type input_pos = 0,
+  const byte_scanner_t* first_bytes = nullptr);
+
+// where the longest match starting at input_pos ends, npos if none. The
+// automaton must be anchored (only starting the program at input_pos)
+std::string_view::size_type dfa_longest_match_end(
+  lazy_dfa_t& dfa, std::string_view input,
+  std::string_view::size_type input_pos);
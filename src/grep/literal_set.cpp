@@ -0,0 +1,124 @@
+#include "grep/literal_set.hpp"
+
+#include <algorithm>
+#include <deque>
+
+#include "grep/prefilter.hpp"
+
+literal_set_t make_literal_set(
+  std::vector<std::string> literals, const bool ignore_case) {
+  literal_set_t set;
+  byte_set_t used;
+  byte_set_t first_bytes;
+  if (ignore_case) {
+    for (auto& literal : literals) {
+      std::ranges::transform(literal, literal.begin(), ascii_lower);
+    }
+  }
+  for (const auto& literal : literals) {
+    for (const char c : literal) {
+      used.set(static_cast<unsigned char>(c));
+    }
+    if (!literal.empty()) {
+      first_bytes.set(static_cast<unsigned char>(literal.front()));
+    }
+  }
+  for (int c = 0; c < 256; c++) {
+    if (used[c]) {
+      set.byte_classes[c] = static_cast<uint8_t>(set.class_count++);
+    }
+  }
+  if (!used.all()) {
+    for (int c = 0; c < 256; c++) {
+      if (!used[c]) {
+        set.byte_classes[c] = static_cast<uint8_t>(set.class_count);
+      }
+    }
+    set.class_count++;
+  }
+  if (ignore_case) {
+    for (int c = 'A'; c <= 'Z'; c++) {
+      set.byte_classes[c] = set.byte_classes[c - 'A' + 'a'];
+    }
+    first_bytes = fold_case(first_bytes);
+  }
+  const auto add_state = [&set] {
+    set.transitions.resize(set.transitions.size() + set.class_count, -1);
+    set.accepting.push_back(0);
+    return static_cast<int32_t>(set.accepting.size()) - 1;
+  };
+  // trie
+  add_state();
+  for (const auto& literal : literals) {
+    int32_t state = 0;
+    for (const char c : literal) {
+      const auto cls = set.byte_classes[static_cast<unsigned char>(c)];
+      if (set.transitions[state * set.class_count + cls] < 0) {
+        const int32_t next = add_state();
+        set.transitions[state * set.class_count + cls] = next;
+      }
+      state = set.transitions[state * set.class_count + cls];
+    }
+    set.accepting[state] = 1;
+  }
+  // breadth first, a missing edge follows the failure link (whose row is
+  // already complete as it is shallower)
+  std::vector<int32_t> failure(set.accepting.size(), 0);
+  std::deque<int32_t> queue;
+  for (int cls = 0; cls < set.class_count; cls++) {
+    auto& next = set.transitions[cls];
+    if (next < 0) {
+      next = 0;
+    } else {
+      queue.push_back(next);
+    }
+  }
+  while (!queue.empty()) {
+    const int32_t state = queue.front();
+    queue.pop_front();
+    set.accepting[state] |= set.accepting[failure[state]];
+    for (int cls = 0; cls < set.class_count; cls++) {
+      auto& next = set.transitions[state * set.class_count + cls];
+      const int32_t fallback =
+        set.transitions[failure[state] * set.class_count + cls];
+      if (next < 0) {
+        next = fallback;
+      } else {
+        failure[next] = fallback;
+        queue.push_back(next);
+      }
+    }
+  }
+  if (first_bytes.count() <= prefilter_t::max_first_bytes) {
+    set.first_bytes = make_byte_scanner(first_bytes);
+  }
+  return set;
+}
+
+// position of the last byte of the first literal found in input from pos
+// (pos itself for an empty literal), npos if there is none
+std::string_view::size_type find_in_literal_set(
+  const literal_set_t& set, const std::string_view input,
+  std::string_view::size_type pos) {
+  if (set.accepting[0] != 0) {
+    return pos;
+  }
+  const char* p = input.data() + pos;
+  const char* const end = input.data() + input.size();
+  int32_t state = 0;
+  while (p != end) {
+    if (state == 0 && set.first_bytes) {
+      if ((p = find_byte(*set.first_bytes, p, end)) == end) {
+        break;
+      }
+    }
+    state = set.transitions
+              [state * set.class_count
+               + set.byte_classes[static_cast<unsigned char>(*p)]];
+    if (set.accepting[state] != 0) {
+      return p - input.data();
+    }
+    p++;
+  }
+  return std::string_view::npos;
+}
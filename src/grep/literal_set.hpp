@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+
+// aho-corasick automaton finding any of a set of literals in one pass, with
+// the failure links resolved into a dense transition table. Bytes that occur
+// in no literal behave alike and share a class, which keeps the rows short
+struct literal_set_t {
+  std::array<uint8_t, 256> byte_classes{};
+  int class_count = 0;
+  // class_count entries per state, state 0 is the root
+  std::vector<int32_t> transitions;
+  // a literal ends at the state (or at one of its suffixes)
+  std::vector<uint8_t> accepting;
+  // first bytes of the literals, for skipping ahead while at the root
+  std::optional<byte_scanner_t> first_bytes;
+};
+
+// with ignore_case both cases of a letter share a byte class, so letters
+// match in either case
+literal_set_t make_literal_set(
+  std::vector<std::string> literals, bool ignore_case = false);
+
+// position of the last byte of the first literal found in input from pos
+// (pos itself for an empty literal), npos if there is none
+std::string_view::size_type find_in_literal_set(
+  const literal_set_t& set, std::string_view input,
+  std::string_view::size_type pos = 0);
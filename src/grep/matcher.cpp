@@ -0,0 +1,245 @@
+#include "grep/matcher.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+
+#include "grep/pattern.hpp"
+
+namespace {
+
+// the text a parsed pattern matches if it is a plain literal
+std::optional<std::string> literal_text(
+  const std::vector<std::vector<pattern_token_t>>& alternatives) {
+  if (alternatives.size() > 1) {
+    return std::nullopt;
+  }
+  std::string text;
+  if (alternatives.empty()) {
+    return text;
+  }
+  for (const auto& token : alternatives.front()) {
+    const auto* literal = std::get_if<literal_t>(&token);
+    if (literal == nullptr || literal->quantifier) {
+      return std::nullopt;
+    }
+    text.push_back(literal->l);
+  }
+  return text;
+}
+
+// renumbers backreferences when patterns are combined, as capture groups are
+// numbered across all of them
+void offset_backreferences(
+  std::vector<std::vector<pattern_token_t>>& alternatives, const int offset) {
+  for (auto& pattern_tokens : alternatives) {
+    for (auto& token : pattern_tokens) {
+      if (auto* backreference = std::get_if<backreference_t>(&token)) {
+        backreference->number += offset;
+      } else if (auto* capture = std::get_if<capture_group_t>(&token)) {
+        offset_backreferences(*capture->pattern, offset);
+      }
+    }
+  }
+}
+
+// a backreference must name one of the pattern's capture groups (numbered
+// from 1), which it is compiled to read
+void check_backreferences(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  const int capture_count) {
+  for (const auto& pattern_tokens : alternatives) {
+    for (const auto& token : pattern_tokens) {
+      if (const auto* backreference = std::get_if<backreference_t>(&token)) {
+        const int number = backreference->number;
+        if (number < 1 || number > capture_count) {
+          throw std::runtime_error(
+            "Invalid backreference \\" + std::to_string(number));
+        }
+      } else if (const auto* capture = std::get_if<capture_group_t>(&token)) {
+        check_backreferences(*capture->pattern, capture_count);
+      }
+    }
+  }
+}
+
+} // namespace
+
+// a line matches if it matches any of the patterns, which are combined into
+// a single program (a literal set when every pattern is a literal, fixed
+// strings are never parsed). With ignore_case letters match in either case
+compiled_pattern_t compile_patterns(
+  const std::vector<std::string>& patterns, const bool fixed_strings,
+  const bool ignore_case) {
+  std::vector<std::vector<pattern_token_t>> alternatives;
+  std::vector<std::string> literals;
+  bool all_literals = true;
+  int capture_count = 0;
+  for (const auto& pattern : patterns) {
+    std::vector<std::vector<pattern_token_t>> parsed;
+    if (fixed_strings) {
+      parsed.emplace_back();
+      for (const char c : pattern) {
+        parsed.back().push_back(literal_t{.l = c});
+      }
+    } else {
+      parsed = parse_pattern(pattern);
+    }
+    if (auto literal = literal_text(parsed); literal && all_literals) {
+      literals.push_back(std::move(*literal));
+    } else {
+      all_literals = false;
+    }
+    const auto pattern_captures =
+      static_cast<int>(get_capture_groups(parsed).size());
+    check_backreferences(parsed, pattern_captures);
+    offset_backreferences(parsed, capture_count);
+    capture_count += pattern_captures;
+    if (parsed.empty()) {
+      // an empty pattern matches everything
+      parsed.emplace_back();
+    }
+    alternatives.insert(
+      alternatives.end(), std::make_move_iterator(parsed.begin()),
+      std::make_move_iterator(parsed.end()));
+  }
+  if (patterns.empty()) {
+    // like grep, no patterns (an empty -f file) match no line: a byte from
+    // the empty set
+    alternatives.emplace_back();
+    alternatives.back().push_back(positive_character_group_t{});
+  }
+  compiled_pattern_t compiled;
+  if (all_literals && literals.size() > 1) {
+    compiled.literal_set = std::make_shared<const literal_set_t>(
+      make_literal_set(std::move(literals), ignore_case));
+  }
+  const auto capture_groups = get_capture_groups(alternatives);
+  for (std::size_t i = 0; i < capture_groups.size(); i++) {
+    capture_groups[i]->index = static_cast<int>(i);
+  }
+  compiled.program = std::make_shared<const program_t>(compile_program(
+    alternatives, static_cast<int>(capture_groups.size()), ignore_case));
+  if (compiled.literal_set) {
+    // the literal set is its own prefilter
+    return compiled;
+  }
+  if (compiled.program->has_backreferences) {
+    compiled.prefilter = make_prefilter(alternatives, nullptr, ignore_case);
+  } else {
+    const auto search_dfa = make_lazy_dfa(compiled.program, true);
+    compiled.prefilter =
+      make_prefilter(alternatives, &search_dfa, ignore_case);
+  }
+  return compiled;
+}
+
+match_stats_t& match_stats_t::operator+=(const match_stats_t& other) {
+  bytes_scanned += other.bytes_scanned;
+  lines_scanned += other.lines_scanned;
+  candidate_lines += other.candidate_lines;
+  matched_lines += other.matched_lines;
+  dfa_searches += other.dfa_searches;
+  backtrack_searches += other.backtrack_searches;
+  backtrack.steps += other.backtrack.steps;
+  backtrack.memo_hits += other.backtrack.memo_hits;
+  backtrack.max_stack_depth =
+    std::max(backtrack.max_stack_depth, other.backtrack.max_stack_depth);
+  scan_time += other.scan_time;
+  read_time += other.read_time;
+  return *this;
+}
+
+match_scratch_t make_match_scratch(const compiled_pattern_t& compiled) {
+  match_scratch_t scratch;
+  scratch.captures.resize(compiled.program->capture_count);
+  if (!compiled.program->has_backreferences) {
+    scratch.search_dfa = make_lazy_dfa(compiled.program, true);
+    scratch.match_dfa = make_lazy_dfa(compiled.program, false);
+  } else {
+    scratch.backtrack_memo.key_size =
+      2 + 2 * compiled.program->referenced_captures.size();
+  }
+  return scratch;
+}
+
+bool matches(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  const std::string_view input) {
+  auto* stats = scratch.stats.get();
+  if (stats != nullptr) {
+    stats->candidate_lines++;
+  }
+  if (compiled.literal_set) {
+    return find_in_literal_set(*compiled.literal_set, input)
+        != std::string_view::npos;
+  }
+  const auto from = apply_prefilter(compiled.prefilter, input);
+  if (!from) {
+    return false;
+  }
+  if (!compiled.program->has_backreferences) {
+    if (stats != nullptr) {
+      stats->dfa_searches++;
+    }
+    const auto& first_bytes = compiled.prefilter.first_bytes;
+    return dfa_search(
+      scratch.search_dfa, input, *from, first_bytes ? &*first_bytes : nullptr);
+  }
+  if (stats != nullptr) {
+    stats->backtrack_searches++;
+  }
+  const auto result = backtrack_search(
+    *compiled.program, input, *from, scratch.captures, scratch.backtrack_memo,
+    scratch.backtrack_stack, scratch.backtrack_budget,
+    stats != nullptr ? &stats->backtrack : nullptr);
+  if (result == backtrack_result_e::over_budget) {
+    scratch.lines_over_budget++;
+  }
+  return result == backtrack_result_e::match;
+}
+
+std::optional<match_span_t> find_match(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  const std::string_view input, const std::size_t from) {
+  if (compiled.program->has_backreferences) {
+    capture_span_t longest;
+    const auto result = backtrack_search(
+      *compiled.program, input, from, scratch.captures, scratch.backtrack_memo,
+      scratch.backtrack_stack, scratch.backtrack_budget, nullptr, &longest);
+    if (result != backtrack_result_e::match) {
+      return std::nullopt;
+    }
+    return match_span_t{
+      .start = static_cast<std::size_t>(longest.start),
+      .end = static_cast<std::size_t>(longest.end)};
+  }
+  const auto& first_bytes = compiled.prefilter.first_bytes;
+  const auto* scanner = first_bytes ? &*first_bytes : nullptr;
+  const auto first_end =
+    dfa_first_match_end(scratch.search_dfa, input, from, scanner);
+  if (first_end == std::string_view::npos) {
+    return std::nullopt;
+  }
+  // the leftmost match starts at or before the end of the first one to end,
+  // each start up to it is tried with the anchored automaton
+  for (auto start = from; start <= first_end; start++) {
+    if (scanner != nullptr) {
+      const char* const end = input.data() + input.size();
+      start = find_byte(*scanner, input.data() + start, end) - input.data();
+      if (start > first_end) {
+        break;
+      }
+    }
+    if (const auto end =
+          dfa_longest_match_end(scratch.match_dfa, input, start);
+        end != std::string_view::npos) {
+      return match_span_t{.start = start, .end = end};
+    }
+  }
+  return std::nullopt;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// match engine entry points: patterns are compiled once with
+// compile_patterns, then each thread matches lines with its own scratch
+// (make_match_scratch and matches, or scan_buffer in grep/scan.hpp for
+// buffers holding many lines)
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grep/backtrack.hpp"
+#include "grep/dfa.hpp"
+#include "grep/literal_set.hpp"
+#include "grep/prefilter.hpp"
+#include "grep/program.hpp"
+
+// a pattern parsed once and then matched against many inputs, it is not
+// modified by matching so one compiled pattern can be shared by threads
+struct compiled_pattern_t {
+  std::shared_ptr<const program_t> program;
+  prefilter_t prefilter;
+  // set instead of running the program when every pattern is a literal
+  std::shared_ptr<const literal_set_t> literal_set;
+};
+
+// a line matches if it matches any of the patterns, which are combined into
+// a single program (a literal set when every pattern is a literal, fixed
+// strings are never parsed). With ignore_case letters match in either case
+compiled_pattern_t compile_patterns(
+  const std::vector<std::string>& patterns, bool fixed_strings,
+  bool ignore_case = false);
+
+// counters for finding out where matching time goes, kept per thread and
+// summed with +=. Only collected for a scratch with stats
+struct match_stats_t {
+  uint64_t bytes_scanned = 0;
+  uint64_t lines_scanned = 0;
+  // lines the prefilter could not rule out without looking at the line
+  uint64_t candidate_lines = 0;
+  uint64_t matched_lines = 0;
+  // engine invocations, on candidate lines the line prefilter did not reject
+  uint64_t dfa_searches = 0;
+  uint64_t backtrack_searches = 0;
+  backtrack_stats_t backtrack;
+  // scanning (including page faults of mapped files and on_line) and
+  // waiting for reads of streamed input
+  std::chrono::nanoseconds scan_time{};
+  std::chrono::nanoseconds read_time{};
+
+  match_stats_t& operator+=(const match_stats_t& other);
+};
+
+// state updated while matching a compiled pattern, owned by the caller (one
+// per thread) and reused for every input so matching does not allocate
+struct match_scratch_t {
+  // by capture group index, offsets into the input being matched
+  std::vector<capture_span_t> captures;
+  // automaton engine cache, unused when the pattern has backreferences
+  lazy_dfa_t search_dfa;
+  // anchored automaton finding where matches end, only used by find_match
+  lazy_dfa_t match_dfa;
+  // backtracking engine state, used when it has
+  backtrack_memo_t backtrack_memo;
+  std::vector<backtrack_frame_t> backtrack_stack;
+  // work the backtracking engine may do per line (see backtrack_search),
+  // lines it gives up on do not match and are counted
+  uint64_t backtrack_budget = default_backtrack_budget;
+  uint64_t lines_over_budget = 0;
+  // null unless counting, so matching pays one test per line for it
+  std::unique_ptr<match_stats_t> stats;
+};
+
+match_scratch_t make_match_scratch(const compiled_pattern_t& compiled);
+
+// returns true if the pattern matches anywhere in input (a single line), false
+// if the backtracking engine ran out of budget on it
+bool matches(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  std::string_view input);
+
+// offsets into the input a match spans
+struct match_span_t {
+  std::size_t start = 0;
+  std::size_t end = 0;
+};
+
+// the leftmost match in input (a single line) starting at or after from,
+// the longest of those starting there. nullopt if there is none or the
+// backtracking engine ran out of budget
+std::optional<match_span_t> find_match(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  std::string_view input, std::size_t from = 0);
@@ -0,0 +1,286 @@
+#include "grep/pattern.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace {
+
+bool is_literal(const char c) {
+  // todo - more regex meta characters to add
+  return c != '\\' && c != '[' && c != '(' && c != '|';
+}
+
+bool anchored_at_beginning(const char c) {
+  return c == '^';
+}
+
+bool anchored_at_end(const std::string_view subpattern) {
+  assert(subpattern.size() == 2);
+  return subpattern[0] != '\\' && subpattern[1] == '$';
+}
+
+bool is_escape(const char c) {
+  return c == '\\';
+}
+
+bool is_character_opener(const char c) {
+  return c == '[';
+}
+
+bool is_capture_group_opener(const char c) {
+  return c == '(';
+}
+
+bool is_alternator(const char c) {
+  return c == '|';
+}
+
+bool is_negating(const std::string_view subpattern) {
+  assert(subpattern.size() == 2);
+  return subpattern[0] == '[' && subpattern[1] == '^';
+}
+
+bool is_digit_character_class(const char c) {
+  return c == 'd';
+}
+
+bool is_word_character_class(const char c) {
+  return c == 'w';
+}
+
+bool is_number(unsigned char c) {
+  return std::isdigit(c);
+}
+
+// characters between [ and ], a '-' between two characters is a range
+// (a-z) and is taken literally at either end
+byte_set_t parse_character_group(const std::string_view characters) {
+  byte_set_t byte_set;
+  for (std::size_t i = 0; i < characters.size(); i++) {
+    const auto first = static_cast<unsigned char>(characters[i]);
+    if (i + 2 < characters.size() && characters[i + 1] == '-') {
+      const auto last = static_cast<unsigned char>(characters[i + 2]);
+      for (int c = first; c <= last; c++) {
+        byte_set.set(c);
+      }
+      i += 2;
+    } else {
+      byte_set.set(first);
+    }
+  }
+  return byte_set;
+}
+
+void set_quantifier(pattern_token_t& token, const quantifier_t quantifier) {
+  if (auto* p = std::get_if<literal_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<digit_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<word_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<negative_character_group_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<positive_character_group_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<capture_group_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<wildcard_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (auto* p = std::get_if<backreference_t>(&token)) {
+    p->quantifier = quantifier;
+  } else if (std::holds_alternative<begin_anchor_t>(token)) {
+    // noop
+  } else if (std::holds_alternative<end_anchor_t>(token)) {
+    // noop
+  }
+}
+
+// quantifies the last token, malformed patterns are rejected with the
+// errors static_parse_pattern gives
+void quantify_last(
+  std::vector<pattern_token_t>& pattern_tokens, const quantifier_t quantifier) {
+  if (pattern_tokens.empty()) {
+    throw std::runtime_error("Quantifier without a token");
+  }
+  set_quantifier(pattern_tokens.back(), quantifier);
+}
+
+} // namespace
+
+std::optional<quantifier_t> get_quantifier(const pattern_token_t& token) {
+  if (auto* p = std::get_if<literal_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<digit_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<word_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<negative_character_group_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<positive_character_group_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<capture_group_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<wildcard_t>(&token)) {
+    return p->quantifier;
+  } else if (auto* p = std::get_if<backreference_t>(&token)) {
+    return p->quantifier;
+  }
+  // begin_anchor_t or end_anchor_t
+  return std::nullopt;
+}
+
+std::vector<std::vector<pattern_token_t>> parse_pattern(
+  const std::string_view pattern) {
+  std::vector<std::vector<pattern_token_t>> all_pattern_tokens;
+  std::vector<pattern_token_t> pattern_tokens;
+  const bool anchored_beginning =
+    !pattern.empty() && anchored_at_beginning(pattern.front());
+  if (anchored_beginning) {
+    pattern_tokens.push_back(begin_anchor_t{});
+  }
+  const bool anchored_end =
+    pattern.size() >= 2 ? anchored_at_end(pattern.substr(pattern.size() - 2, 2))
+                        : false;
+  for (int p = anchored_beginning ? 1 : 0;
+       p < (anchored_end ? pattern.size() - 1 : pattern.size());) {
+    if (is_literal(pattern[p])) {
+      if (pattern[p] == '+') {
+        quantify_last(pattern_tokens, one_or_more_t{});
+        p++;
+      } else if (pattern[p] == '?') {
+        quantify_last(pattern_tokens, zero_or_one_t{});
+        p++;
+      } else if (pattern[p] == '*') {
+        quantify_last(pattern_tokens, zero_or_more_t{});
+        p++;
+      } else if (pattern[p] == '{') {
+        const auto opening = pattern.begin() + p + 1;
+        const auto closing =
+          std::find_if_not(opening, pattern.end(), is_number);
+        if (
+          closing == opening || closing == pattern.end() || *closing != '}') {
+          throw std::runtime_error("Expected a count in {}");
+        }
+        const auto length = closing - opening;
+        const auto times =
+          std::stoi(std::string(pattern.substr(p + 1, length)));
+        quantify_last(pattern_tokens, n_times_t{.n_times = times});
+        p += length + 2;
+      } else if (pattern[p] == '.') {
+        pattern_tokens.push_back(wildcard_t{});
+        p++;
+      } else {
+        pattern_tokens.push_back(literal_t{.l = pattern[p++]});
+      }
+    } else {
+      if (is_escape(pattern[p])) {
+        if (p + 1 == pattern.size()) {
+          throw std::runtime_error("Trailing backslash");
+        }
+        if (is_digit_character_class(pattern[p + 1])) {
+          pattern_tokens.push_back(digit_t{});
+          p += 2;
+        } else if (is_word_character_class(pattern[p + 1])) {
+          pattern_tokens.push_back(word_t{});
+          p += 2;
+        } else if (pattern[p + 1] == '\\') {
+          pattern_tokens.push_back(literal_t{.l = '\\'});
+          p += 2;
+        } else if (is_number(pattern[p + 1])) {
+          const auto number_start = pattern.begin() + p + 1;
+          const auto number_end =
+            std::find_if_not(number_start, pattern.end(), is_number);
+          const auto number =
+            std::stoi(std::string(std::string_view(number_start, number_end)));
+          pattern_tokens.push_back(backreference_t{.number = number});
+          p += 1 + std::distance(number_start, number_end);
+        } else {
+          // any other escaped character stands for itself
+          pattern_tokens.push_back(literal_t{.l = pattern[p + 1]});
+          p += 2;
+        }
+      } else if (is_character_opener(pattern[p])) {
+        if (pattern.find(']', p + 1) == std::string_view::npos) {
+          throw std::runtime_error("Unterminated character group");
+        }
+        if (is_negating(pattern.substr(p, 2))) {
+          const auto offset = p + 2;
+          const auto end = pattern.find(']', offset);
+          const auto characters = pattern.substr(offset, end - offset);
+          pattern_tokens.push_back(
+            negative_character_group_t{
+              .characters = parse_character_group(characters)});
+          p += characters.size() + 3;
+        } else {
+          const auto offset = p + 1;
+          const auto end = pattern.find(']', offset);
+          const auto characters = pattern.substr(offset, end - offset);
+          pattern_tokens.push_back(
+            positive_character_group_t{
+              .characters = parse_character_group(characters)});
+          p += characters.size() + 2;
+        }
+      } else if (is_capture_group_opener(pattern[p])) {
+        const auto offset = p + 1;
+        capture_group_t capture_group;
+        std::string sub_pattern;
+        int nesting_depth = 0;
+        for (int i = offset, size = 0;; size++, i++) {
+          if (i == static_cast<int>(pattern.size())) {
+            throw std::runtime_error("Unterminated capture group");
+          }
+          if (pattern[i] == '(') {
+            nesting_depth++;
+          } else if (pattern[i] == ')') {
+            if (nesting_depth == 0) {
+              sub_pattern = pattern.substr(offset, size);
+              capture_group.pattern =
+                std::make_unique<std::vector<std::vector<pattern_token_t>>>(
+                  parse_pattern(sub_pattern));
+              break;
+            } else {
+              nesting_depth--;
+            }
+          }
+        }
+        p += sub_pattern.size() + 2;
+        pattern_tokens.push_back(std::move(capture_group));
+      } else if (is_alternator(pattern[p])) {
+        all_pattern_tokens.push_back(std::move(pattern_tokens));
+        pattern_tokens.clear();
+        p++;
+      }
+    }
+  }
+  if (anchored_end) {
+    pattern_tokens.push_back(end_anchor_t{});
+  }
+  if (!pattern_tokens.empty()) {
+    all_pattern_tokens.push_back(std::move(pattern_tokens));
+  }
+  return all_pattern_tokens;
+}
+
+std::vector<capture_group_t*> get_capture_groups(
+  std::vector<std::vector<pattern_token_t>>& parsed_pattern) {
+  return std::accumulate(
+    parsed_pattern.begin(), parsed_pattern.end(),
+    std::vector<capture_group_t*>{},
+    [](
+      std::vector<capture_group_t*> acc,
+      std::vector<pattern_token_t>& pattern_tokens) {
+      for (auto& pattern_token : pattern_tokens) {
+        if (
+          auto* capture_group = std::get_if<capture_group_t>(&pattern_token)) {
+          auto sub_capture_groups = get_capture_groups(*capture_group->pattern);
+          acc.push_back(capture_group);
+          acc.insert(
+            acc.end(), sub_capture_groups.begin(), sub_capture_groups.end());
+        }
+      }
+      return acc;
+    });
+}
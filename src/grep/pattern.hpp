@@ -0,0 +1,95 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+
+struct one_or_more_t {};
+struct zero_or_one_t {};
+struct zero_or_more_t {};
+struct n_times_t {
+  int n_times;
+};
+
+// enum class quantifier_e { one_or_more, zero_or_one, zero_or_more };
+using quantifier_t =
+  std::variant<one_or_more_t, zero_or_one_t, zero_or_more_t, n_times_t>;
+
+struct literal_t {
+  std::optional<quantifier_t> quantifier;
+  char l;
+};
+
+struct digit_t {
+  std::optional<quantifier_t> quantifier;
+};
+
+struct word_t {
+  std::optional<quantifier_t> quantifier;
+};
+
+struct positive_character_group_t {
+  byte_set_t characters;
+  std::optional<quantifier_t> quantifier;
+};
+
+struct negative_character_group_t {
+  // the characters listed, which the group does not match
+  byte_set_t characters;
+  std::optional<quantifier_t> quantifier;
+};
+
+struct wildcard_t {
+  std::optional<quantifier_t> quantifier;
+};
+
+struct backreference_t {
+  int number;
+  std::optional<quantifier_t> quantifier;
+};
+
+struct begin_anchor_t {};
+struct end_anchor_t {};
+
+struct capture_group_t {
+  // type matches pattern_token_t
+  using internal_pattern_t = std::vector<std::vector<std::variant<
+    literal_t, digit_t, word_t, positive_character_group_t,
+    negative_character_group_t, begin_anchor_t, end_anchor_t, wildcard_t,
+    capture_group_t, backreference_t>>>;
+
+  std::unique_ptr<internal_pattern_t> pattern;
+  // position in get_capture_groups order, assigned by compile_patterns
+  int index = -1;
+  std::optional<quantifier_t> quantifier;
+};
+
+using pattern_token_t = std::variant<
+  literal_t, digit_t, word_t, positive_character_group_t,
+  negative_character_group_t, begin_anchor_t, end_anchor_t, wildcard_t,
+  capture_group_t, backreference_t>;
+
+std::optional<quantifier_t> get_quantifier(const pattern_token_t& token);
+
+// alternatives of token sequences (pattern_tokens), the pattern matches if
+// any of them does
+std::vector<std::vector<pattern_token_t>> parse_pattern(
+  std::string_view pattern);
+
+template<typename T>
+bool holds_alternative(const std::optional<quantifier_t>& optional_quantifier) {
+  return optional_quantifier
+    .transform([](const auto& quantifier) {
+      return std::holds_alternative<T>(quantifier);
+    })
+    .value_or(false);
+}
+
+// every capture group in the order their opening parentheses appear, which
+// is the order of their backreference numbers
+std::vector<capture_group_t*> get_capture_groups(
+  std::vector<std::vector<pattern_token_t>>& parsed_pattern);
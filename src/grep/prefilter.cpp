@@ -0,0 +1,302 @@
+#include "grep/prefilter.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ranges>
+#include <utility>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GREP_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// literals of which every match of the token sequence contains at least one
+std::vector<std::string> required_literals(
+  const std::vector<std::vector<pattern_token_t>>& alternatives);
+
+std::vector<std::string> required_literals(
+  const std::vector<pattern_token_t>& pattern_tokens) {
+  std::vector<std::string> best;
+  const auto shortest = [](const std::vector<std::string>& literals) {
+    return std::ranges::min(
+      literals | std::views::transform(&std::string::size));
+  };
+  const auto consider = [&best, &shortest](std::vector<std::string> literals) {
+    if (literals.empty() || shortest(literals) == 0) {
+      return;
+    }
+    if (best.empty() || shortest(literals) > shortest(best)) {
+      best = std::move(literals);
+    }
+  };
+  for (auto& part : required_parts(pattern_tokens)) {
+    if (part.capture) {
+      consider(required_literals(*part.capture));
+    } else {
+      consider({std::move(part.run)});
+    }
+  }
+  return best;
+}
+
+std::vector<std::string> required_literals(
+  const std::vector<std::vector<pattern_token_t>>& alternatives) {
+  std::vector<std::string> literals;
+  for (const auto& pattern_tokens : alternatives) {
+    auto branch_literals = required_literals(pattern_tokens);
+    if (branch_literals.empty()) {
+      // this branch can match without any literal
+      return {};
+    }
+    literals.insert(
+      literals.end(), std::make_move_iterator(branch_literals.begin()),
+      std::make_move_iterator(branch_literals.end()));
+  }
+  std::ranges::sort(literals);
+  literals.erase(std::ranges::unique(literals).begin(), literals.end());
+  return literals;
+}
+
+bool equal_ignoring_case(const char* input, const std::string_view lower) {
+  for (std::size_t i = 0; i < lower.size(); i++) {
+    if (ascii_lower(input[i]) != lower[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+using size_type = std::string_view::size_type;
+
+size_type find_folded_scalar(
+  const std::string_view input, const std::string_view lower) {
+  for (std::size_t pos = 0; pos + lower.size() <= input.size(); pos++) {
+    if (equal_ignoring_case(input.data() + pos, lower)) {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+#if defined(GREP_X86_SIMD)
+// bit set in a byte before comparing it with c, which makes both cases of a
+// letter compare equal (and leaves other bytes alone)
+char case_bit(const char c) {
+  return is_ascii_letter(c) ? 0x20 : 0;
+}
+
+// positions where the first and last byte of the literal both match are
+// found 16 or 32 at a time and only those are compared in full
+size_type find_folded_sse2(
+  const std::string_view input, const std::string_view lower) {
+  const auto first = _mm_set1_epi8(lower.front());
+  const auto first_bit = _mm_set1_epi8(case_bit(lower.front()));
+  const auto last = _mm_set1_epi8(lower.back());
+  const auto last_bit = _mm_set1_epi8(case_bit(lower.back()));
+  const std::size_t last_offset = lower.size() - 1;
+  std::size_t pos = 0;
+  for (; pos + last_offset + 16 <= input.size(); pos += 16) {
+    const auto heads =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(input.data() + pos));
+    const auto tails = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(input.data() + pos + last_offset));
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(_mm_or_si128(heads, first_bit), first),
+      _mm_cmpeq_epi8(_mm_or_si128(tails, last_bit), last))));
+    for (; mask != 0; mask &= mask - 1) {
+      const auto candidate = pos + __builtin_ctz(mask);
+      if (equal_ignoring_case(input.data() + candidate, lower)) {
+        return candidate;
+      }
+    }
+  }
+  const auto found = find_folded_scalar(input.substr(pos), lower);
+  return found != std::string_view::npos ? pos + found : found;
+}
+
+__attribute__((target("avx2"))) size_type find_folded_avx2(
+  const std::string_view input, const std::string_view lower) {
+  const auto first = _mm256_set1_epi8(lower.front());
+  const auto first_bit = _mm256_set1_epi8(case_bit(lower.front()));
+  const auto last = _mm256_set1_epi8(lower.back());
+  const auto last_bit = _mm256_set1_epi8(case_bit(lower.back()));
+  const std::size_t last_offset = lower.size() - 1;
+  std::size_t pos = 0;
+  for (; pos + last_offset + 32 <= input.size(); pos += 32) {
+    const auto heads = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(input.data() + pos));
+    const auto tails = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(input.data() + pos + last_offset));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_or_si256(heads, first_bit), first),
+      _mm256_cmpeq_epi8(_mm256_or_si256(tails, last_bit), last))));
+    for (; mask != 0; mask &= mask - 1) {
+      const auto candidate = pos + __builtin_ctz(mask);
+      if (equal_ignoring_case(input.data() + candidate, lower)) {
+        return candidate;
+      }
+    }
+  }
+  const auto found = find_folded_sse2(input.substr(pos), lower);
+  return found != std::string_view::npos ? pos + found : found;
+}
+#endif
+
+using find_folded_fn_t = size_type (*)(std::string_view, std::string_view);
+
+find_folded_fn_t select_find_folded() {
+#if defined(GREP_X86_SIMD)
+  if (__builtin_cpu_supports("avx2")) {
+    return find_folded_avx2;
+  }
+  return find_folded_sse2;
+#else
+  return find_folded_scalar;
+#endif
+}
+
+size_type find_folded(
+  const std::string_view input, const std::string_view lower) {
+  static const find_folded_fn_t find_folded_fn = select_find_folded();
+  if (lower.empty()) {
+    return 0;
+  }
+  return find_folded_fn(input, lower);
+}
+
+} // namespace
+
+std::vector<required_part_t> required_parts(
+  const std::vector<pattern_token_t>& pattern_tokens) {
+  std::vector<required_part_t> parts;
+  std::string run;
+  const auto end_run = [&parts, &run] {
+    if (!run.empty()) {
+      parts.push_back({.run = std::exchange(run, {})});
+    }
+  };
+  for (const auto& token : pattern_tokens) {
+    if (
+      std::holds_alternative<begin_anchor_t>(token)
+      || std::holds_alternative<end_anchor_t>(token)) {
+      // zero width, the run continues
+      continue;
+    }
+    const auto quantifier = get_quantifier(token);
+    const bool required = !holds_alternative<zero_or_one_t>(quantifier)
+                       && !holds_alternative<zero_or_more_t>(quantifier);
+    if (auto* literal = std::get_if<literal_t>(&token); literal && required) {
+      if (auto* n_times = std::get_if<n_times_t>(&*quantifier)) {
+        run.append(n_times->n_times, literal->l);
+      } else {
+        run.push_back(literal->l);
+        // one_or_more ends the run as further repeats may follow
+        if (quantifier) {
+          end_run();
+        }
+      }
+      continue;
+    }
+    end_run();
+    if (auto* capture = std::get_if<capture_group_t>(&token);
+        capture && required) {
+      parts.push_back({.capture = capture->pattern.get()});
+    }
+  }
+  end_run();
+  return parts;
+}
+
+prefilter_t make_prefilter(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  const lazy_dfa_t* search_dfa, const bool ignore_case) {
+  prefilter_t prefilter{.ignore_case = ignore_case};
+  if (auto literals = required_literals(alternatives);
+      literals.size() <= prefilter_t::max_literals) {
+    prefilter.literals = std::move(literals);
+  }
+  if (ignore_case) {
+    for (auto& literal : prefilter.literals) {
+      std::ranges::transform(literal, literal.begin(), ascii_lower);
+    }
+    std::ranges::sort(prefilter.literals);
+    prefilter.literals.erase(
+      std::ranges::unique(prefilter.literals).begin(),
+      prefilter.literals.end());
+  }
+  if (search_dfa == nullptr) {
+    return prefilter;
+  }
+  // the instructions reachable at the start of a match tell us which bytes
+  // it can begin with (any match or end state means a match can be empty)
+  const auto& program = *search_dfa->program;
+  prefilter.anchored_at_begin =
+    search_dfa->state_sets[search_dfa->mid_start].empty();
+  byte_set_t first_bytes;
+  for (const int state : search_dfa->state_sets[search_dfa->begin_start]) {
+    const auto& instruction = program.instructions[state];
+    if (!consumes_byte(instruction)) {
+      return prefilter;
+    }
+    for (int c = 0; c < 256; c++) {
+      if (matches_byte(program, instruction, c)) {
+        first_bytes.set(c);
+      }
+    }
+  }
+  if (first_bytes.count() <= prefilter_t::max_first_bytes) {
+    prefilter.first_bytes = make_byte_scanner(first_bytes);
+  }
+  return prefilter;
+}
+
+std::string_view::size_type find_literal(
+  const std::string_view input, const std::string_view literal,
+  const bool ignore_case) {
+  if (ignore_case) {
+    return find_folded(input, literal);
+  }
+#if defined(__GLIBC__) || defined(__APPLE__)
+  // memmem is vectorized by the c library
+  const void* found =
+    memmem(input.data(), input.size(), literal.data(), literal.size());
+  return found != nullptr ? static_cast<const char*>(found) - input.data()
+                          : std::string_view::npos;
+#else
+  return input.find(literal);
+#endif
+}
+
+// position from which the input could match, nullopt if it cannot match
+std::optional<std::string_view::size_type> apply_prefilter(
+  const prefilter_t& prefilter, const std::string_view input) {
+  if (
+    !prefilter.literals.empty()
+    && std::ranges::none_of(prefilter.literals, [&](const auto& literal) {
+         return find_literal(input, literal, prefilter.ignore_case)
+             != std::string_view::npos;
+       })) {
+    return std::nullopt;
+  }
+  if (!prefilter.first_bytes) {
+    return 0;
+  }
+  if (prefilter.anchored_at_begin) {
+    if (
+      input.empty()
+      || !prefilter.first_bytes->byte_set[static_cast<unsigned char>(
+        input.front())]) {
+      return std::nullopt;
+    }
+    return 0;
+  }
+  const char* input_end = input.data() + input.size();
+  const char* first =
+    find_byte(*prefilter.first_bytes, input.data(), input_end);
+  if (first == input_end) {
+    return std::nullopt;
+  }
+  return first - input.data();
+}
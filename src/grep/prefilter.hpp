@@ -0,0 +1,57 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+#include "grep/dfa.hpp"
+#include "grep/pattern.hpp"
+
+// cheap checks run before the regex engine to reject inputs that cannot match
+struct prefilter_t {
+  static constexpr int max_literals = 16;
+  // larger sets match too much of typical text to be worth skipping to
+  static constexpr int max_first_bytes = 32;
+
+  // every match contains at least one of these (no check when empty)
+  std::vector<std::string> literals;
+  // every match starts with one of these bytes (no check when nullopt)
+  std::optional<byte_scanner_t> first_bytes;
+  // matches can only start at the beginning of the input
+  bool anchored_at_begin = false;
+  // the literals are in lower case and found in either case
+  bool ignore_case = false;
+};
+
+// a literal run or capture group every match of a branch contains
+struct required_part_t {
+  std::string run;
+  // the alternatives of the capture group if not nullptr (and run is empty)
+  const std::vector<std::vector<pattern_token_t>>* capture = nullptr;
+};
+
+// the parts of a branch in order: a literal without a quantifier or
+// repeated n times extends a run, one repeated one or more times ends it,
+// anything else breaks it. Capture groups that must match are parts of
+// their own. Both the prefilter's literals and the trigram index's queries
+// are made from these
+std::vector<required_part_t> required_parts(
+  const std::vector<pattern_token_t>& pattern_tokens);
+
+// search_dfa (nullptr for programs with backreferences) gives the bytes a
+// match can start with
+prefilter_t make_prefilter(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  const lazy_dfa_t* search_dfa, bool ignore_case = false);
+
+// offset of the first occurrence of literal, npos if there is none. With
+// ignore_case literal must be in lower case and letters in input match it
+// in either case
+std::string_view::size_type find_literal(
+  std::string_view input, std::string_view literal, bool ignore_case = false);
+
+// position from which the input could match, nullopt if it cannot match
+std::optional<std::string_view::size_type> apply_prefilter(
+  const prefilter_t& prefilter, std::string_view input);
@@ -0,0 +1,142 @@
+#include "grep/program.hpp"
+
+#include <algorithm>
+
+namespace {
+
+struct program_compiler_t {
+  program_t& program;
+  bool ignore_case = false;
+
+  int emit(const instruction_t instruction) {
+    program.instructions.push_back(instruction);
+    return static_cast<int>(program.instructions.size()) - 1;
+  }
+
+  int next_pc() const {
+    return static_cast<int>(program.instructions.size());
+  }
+
+  void emit_byte_set(const byte_set_t& byte_set) {
+    program.byte_sets.push_back(ignore_case ? fold_case(byte_set) : byte_set);
+    emit(
+      {.op = opcode_e::byte_set,
+       .x = static_cast<int32_t>(program.byte_sets.size()) - 1});
+  }
+
+  void emit_token(const pattern_token_t& token);
+  void emit_quantified_token(const pattern_token_t& token);
+  void emit_sequence(const std::vector<pattern_token_t>& pattern_tokens);
+  void emit_alternatives(
+    const std::vector<std::vector<pattern_token_t>>& alternatives);
+};
+
+void program_compiler_t::emit_token(const pattern_token_t& token) {
+  if (auto* literal = std::get_if<literal_t>(&token)) {
+    if (ignore_case && is_ascii_letter(literal->l)) {
+      emit_byte_set(byte_set_t().set(static_cast<unsigned char>(literal->l)));
+    } else {
+      emit({.op = opcode_e::byte, .arg = static_cast<uint8_t>(literal->l)});
+    }
+  } else if (std::holds_alternative<digit_t>(token)) {
+    emit_byte_set(digit_byte_set());
+  } else if (std::holds_alternative<word_t>(token)) {
+    emit_byte_set(word_byte_set());
+  } else if (auto* neg = std::get_if<negative_character_group_t>(&token)) {
+    // the listed characters are excluded in either case
+    emit_byte_set(
+      ~(ignore_case ? fold_case(neg->characters) : neg->characters));
+  } else if (auto* pos = std::get_if<positive_character_group_t>(&token)) {
+    emit_byte_set(pos->characters);
+  } else if (std::holds_alternative<wildcard_t>(token)) {
+    emit({.op = opcode_e::any});
+  } else if (auto* capture = std::get_if<capture_group_t>(&token)) {
+    emit({.op = opcode_e::save, .x = 2 * capture->index});
+    emit_alternatives(*capture->pattern);
+    emit({.op = opcode_e::save, .x = 2 * capture->index + 1});
+  } else if (auto* backreference = std::get_if<backreference_t>(&token)) {
+    program.has_backreferences = true;
+    program.referenced_captures.push_back(backreference->number - 1);
+    emit(
+      {.op = opcode_e::backref,
+       .arg = ignore_case,
+       .x = backreference->number - 1});
+  } else if (std::holds_alternative<begin_anchor_t>(token)) {
+    emit({.op = opcode_e::begin});
+  } else if (std::holds_alternative<end_anchor_t>(token)) {
+    emit({.op = opcode_e::end});
+  }
+}
+
+void program_compiler_t::emit_quantified_token(const pattern_token_t& token) {
+  const auto quantifier = get_quantifier(token);
+  if (!quantifier) {
+    emit_token(token);
+  } else if (auto* n_times = std::get_if<n_times_t>(&*quantifier)) {
+    for (int i = 0; i < n_times->n_times; i++) {
+      emit_token(token);
+    }
+  } else if (std::holds_alternative<zero_or_one_t>(*quantifier)) {
+    // split body, out; body; out:
+    const int split = emit({.op = opcode_e::split});
+    emit_token(token);
+    program.instructions[split].x = split + 1;
+    program.instructions[split].y = next_pc();
+  } else if (std::holds_alternative<zero_or_more_t>(*quantifier)) {
+    // loop: split body, out; body; jump loop; out:
+    const int split = emit({.op = opcode_e::split});
+    emit_token(token);
+    emit({.op = opcode_e::jump, .x = split});
+    program.instructions[split].x = split + 1;
+    program.instructions[split].y = next_pc();
+  } else if (std::holds_alternative<one_or_more_t>(*quantifier)) {
+    // body: body; split body, out; out:
+    const int body = next_pc();
+    emit_token(token);
+    emit({.op = opcode_e::split, .x = body, .y = next_pc() + 1});
+  }
+}
+
+void program_compiler_t::emit_sequence(
+  const std::vector<pattern_token_t>& pattern_tokens) {
+  for (const auto& token : pattern_tokens) {
+    emit_quantified_token(token);
+  }
+}
+
+void program_compiler_t::emit_alternatives(
+  const std::vector<std::vector<pattern_token_t>>& alternatives) {
+  // split first, next; first; jump out; next: split second, next; ... out:
+  std::vector<int> jumps_to_end;
+  for (std::size_t i = 0; i < alternatives.size(); i++) {
+    if (i + 1 == alternatives.size()) {
+      emit_sequence(alternatives[i]);
+      break;
+    }
+    const int split = emit({.op = opcode_e::split});
+    program.instructions[split].x = next_pc();
+    emit_sequence(alternatives[i]);
+    jumps_to_end.push_back(emit({.op = opcode_e::jump}));
+    program.instructions[split].y = next_pc();
+  }
+  for (const int jump : jumps_to_end) {
+    program.instructions[jump].x = next_pc();
+  }
+}
+
+} // namespace
+
+// capture groups must have been numbered (see compile_patterns)
+program_t compile_program(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  const int capture_count, const bool ignore_case) {
+  program_t program;
+  program.capture_count = capture_count;
+  program_compiler_t compiler{.program = program, .ignore_case = ignore_case};
+  compiler.emit_alternatives(alternatives);
+  compiler.emit({.op = opcode_e::match});
+  auto& referenced = program.referenced_captures;
+  std::ranges::sort(referenced);
+  referenced.erase(std::ranges::unique(referenced).begin(), referenced.end());
+  return program;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+#include "grep/pattern.hpp"
+
+// patterns are compiled to a flat program of fixed size instructions, each
+// instruction continues at the next one unless it is a split or a jump
+// whose targets are resolved at compile time. Quantifiers become splits and
+// jumps around the repeated code ({n} repeats the code n times), capture
+// groups are bracketed by save instructions recording their start and end
+
+enum class opcode_e : uint8_t {
+  byte,     // matches the byte in arg
+  byte_set, // matches bytes in program_t::byte_sets[x]
+  any,      // matches any byte
+  split,    // continues at both x and y (x preferred)
+  jump,     // continues at x
+  save,     // records the input position in capture slot x
+  begin,    // asserts the start of the input
+  end,      // asserts the end of the input
+  backref,  // matches the text captured by group x again (ignoring case
+            // if arg is 1)
+  match
+};
+
+struct instruction_t {
+  opcode_e op;
+  uint8_t arg = 0;
+  int32_t x = 0;
+  int32_t y = 0;
+};
+
+struct program_t {
+  std::vector<instruction_t> instructions;
+  std::vector<byte_set_t> byte_sets;
+  // two save slots (start and end) per capture group
+  int capture_count = 0;
+  bool has_backreferences = false;
+  // sorted indices of the capture groups backreferences refer to
+  std::vector<int> referenced_captures;
+};
+
+inline bool matches_byte(
+  const program_t& program, const instruction_t& instruction,
+  const unsigned char c) {
+  switch (instruction.op) {
+    case opcode_e::byte:
+      return instruction.arg == c;
+    case opcode_e::byte_set:
+      return program.byte_sets[instruction.x][c];
+    case opcode_e::any:
+      return true;
+    default:
+      return false;
+  }
+}
+
+constexpr bool consumes_byte(const instruction_t& instruction) {
+  return instruction.op == opcode_e::byte
+      || instruction.op == opcode_e::byte_set
+      || instruction.op == opcode_e::any;
+}
+
+// capture groups must have been numbered (see compile_patterns). With
+// ignore_case a letter matches either case: a literal letter becomes a byte
+// set of its two cases and backreferences compare ignoring case
+program_t compile_program(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  int capture_count, bool ignore_case = false);
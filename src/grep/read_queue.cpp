@@ -0,0 +1,504 @@
+#include "grep/read_queue.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define GREP_HAVE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace {
+
+// first read size for an empty buffer, most source files fit
+constexpr std::size_t initial_read_size = 64 << 10;
+
+// makes room past filled (the bytes in it so far) for the next read, false
+// once the file is too large to read
+bool grow_buffer(read_buffer_t& buffer, const std::size_t filled) {
+  if (filled < buffer.capacity) {
+    return true;
+  }
+  if (filled >= max_read_size) {
+    return false;
+  }
+  const auto capacity =
+    std::clamp(2 * filled, initial_read_size, max_read_size);
+  auto data = std::make_unique_for_overwrite<char[]>(capacity);
+  if (filled > 0) {
+    std::memcpy(data.get(), buffer.data.get(), filled);
+  }
+  buffer.data = std::move(data);
+  buffer.capacity = capacity;
+  return true;
+}
+
+read_result_t finish_read(
+  read_request_t& request, const int error, const std::size_t filled) {
+  read_result_t result{
+    .path = std::move(request.path),
+    .tag = request.tag,
+    .error = error,
+    .complete = filled <= max_read_size || error != 0,
+    .buffer = std::move(request.buffer)};
+  result.buffer.size = result.complete && error == 0 ? filled : 0;
+  return result;
+}
+
+// the size of a regular file, checked once it is open so one too large to
+// read is left to the caller without reading any of it (other files, such
+// as pipes, have no size to check)
+bool too_large_to_read(const int fd) {
+  struct stat file_stat {};
+  return fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode)
+      && static_cast<uint64_t>(file_stat.st_size) > max_read_size;
+}
+
+// open, read to the end and close with blocking calls
+read_result_t read_file(read_request_t request) {
+  const int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return finish_read(request, errno, 0);
+  }
+  std::size_t filled = 0;
+  int error = 0;
+  if (too_large_to_read(fd)) {
+    close(fd);
+    return finish_read(request, 0, max_read_size + 1);
+  }
+  for (;;) {
+    if (!grow_buffer(request.buffer, filled)) {
+      // more than max_read_size
+      filled = max_read_size + 1;
+      break;
+    }
+    const auto bytes_read = read(
+      fd, request.buffer.data.get() + filled,
+      request.buffer.capacity - filled);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read < 0) {
+      error = errno;
+      break;
+    }
+    if (bytes_read == 0) {
+      break;
+    }
+    filled += bytes_read;
+  }
+  close(fd);
+  return finish_read(request, error, filled);
+}
+
+} // namespace
+
+struct read_queue_t::threads_t {
+  std::mutex mutex;
+  std::condition_variable requested;
+  std::condition_variable completed;
+  std::deque<read_request_t> requests;
+  // submitted and not yet passed to on_read
+  int in_flight = 0;
+  bool stopping = false;
+  std::vector<std::jthread> threads;
+};
+
+#if defined(GREP_HAVE_IO_URING)
+
+// a submission and completion ring shared with the kernel, driven by the
+// thread submitting reads. Each file has one operation in flight at a
+// time: an open, then reads until one returns nothing. If the ring fails
+// the files in flight fail with it and later ones are read by threads
+struct read_queue_t::ring_t {
+  struct file_t {
+    read_request_t request;
+    int fd = -1;
+    std::size_t filled = 0;
+  };
+
+  int fd = -1;
+  void* rings = MAP_FAILED;
+  std::size_t rings_size = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  std::size_t sqes_size = 0;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_head = nullptr;
+  unsigned sq_mask = 0;
+  unsigned* sq_array = nullptr;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned cq_mask = 0;
+  io_uring_cqe* cqes = nullptr;
+  // queued in the submission ring, not yet passed to the kernel
+  unsigned to_submit = 0;
+  // being opened or read, the operations carry their addresses
+  std::vector<std::unique_ptr<file_t>> files;
+  // errno of the io_uring_enter that failed, 0 while the ring works
+  int error = 0;
+  // the files in flight when the ring failed, whose buffers the kernel may
+  // still write to until it is closed
+  std::vector<std::unique_ptr<file_t>> abandoned;
+
+  ring_t() = default;
+  ring_t(const ring_t&) = delete;
+  ring_t& operator=(const ring_t&) = delete;
+  ~ring_t() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (rings != MAP_FAILED) {
+      munmap(rings, rings_size);
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+    abandoned.clear();
+  }
+};
+
+namespace {
+
+using ring_t = read_queue_t::ring_t;
+
+int ring_setup(const unsigned entries, io_uring_params& params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int ring_enter(
+  const ring_t& ring, const unsigned to_submit, const unsigned min_complete) {
+  return static_cast<int>(syscall(
+    __NR_io_uring_enter, ring.fd, to_submit, min_complete,
+    min_complete > 0 ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0));
+}
+
+// the kernel supports every operation used (probing needs linux 5.6, as
+// does IORING_OP_OPENAT itself)
+bool ring_supports_reads(const ring_t& ring) {
+  constexpr int op_count = 256;
+  std::vector<char> storage(
+    sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op));
+  auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+  if (
+    syscall(
+      __NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, op_count)
+    < 0) {
+    return false;
+  }
+  return std::ranges::all_of(
+    std::initializer_list<int>{IORING_OP_OPENAT, IORING_OP_READ},
+    [probe](const int op) {
+      return op <= probe->last_op
+          && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    });
+}
+
+std::unique_ptr<ring_t> make_ring(const int depth) {
+  auto ring = std::make_unique<ring_t>();
+  io_uring_params params{};
+  ring->fd = ring_setup(static_cast<unsigned>(depth), params);
+  if (ring->fd < 0 || (params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+    return nullptr;
+  }
+  ring->rings_size = std::max(
+    params.sq_off.array + params.sq_entries * sizeof(unsigned),
+    params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  ring->rings = mmap(
+    nullptr, ring->rings_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes = static_cast<io_uring_sqe*>(mmap(
+    nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES));
+  if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED) {
+    return nullptr;
+  }
+  auto* base = static_cast<char*>(ring->rings);
+  ring->sq_head = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  ring->sq_tail = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  ring->sq_mask = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  ring->sq_array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  ring->cq_head = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  ring->cq_tail = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  ring->cq_mask = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  ring->cqes = reinterpret_cast<io_uring_cqe*>(base + params.cq_off.cqes);
+  if (!ring_supports_reads(*ring)) {
+    return nullptr;
+  }
+  return ring;
+}
+
+// passes the queued submissions to the kernel, waiting for min_complete
+// completions. Returns the errno if the ring cannot be used, 0 otherwise
+int ring_submit(ring_t& ring, const unsigned min_complete) {
+  for (;;) {
+    const int submitted = ring_enter(ring, ring.to_submit, min_complete);
+    if (submitted >= 0) {
+      ring.to_submit -= static_cast<unsigned>(submitted);
+      return 0;
+    }
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return errno;
+    }
+  }
+}
+
+// nothing in flight can be waited for once the ring fails, so every file
+// is passed to on_read with the error (callers map failed reads instead)
+void fail_ring(read_queue_t& queue, const int error) {
+  auto& ring = *queue.ring;
+  ring.error = error;
+  for (auto& file : ring.files) {
+    if (file->fd >= 0) {
+      close(file->fd);
+    }
+    read_request_t request{
+      .path = std::move(file->request.path), .tag = file->request.tag};
+    ring.abandoned.push_back(std::move(file));
+    queue.on_read(finish_read(request, error, 0));
+  }
+  ring.files.clear();
+}
+
+io_uring_sqe& next_sqe(ring_t& ring, ring_t::file_t* file) {
+  // each file has one operation in flight, at most depth of them
+  const unsigned tail = *ring.sq_tail;
+  const unsigned index = tail & ring.sq_mask;
+  auto& sqe = ring.sqes[index];
+  sqe = {};
+  sqe.user_data = reinterpret_cast<uint64_t>(file);
+  ring.sq_array[index] = index;
+  std::atomic_ref(*ring.sq_tail).store(tail + 1, std::memory_order_release);
+  ring.to_submit++;
+  return sqe;
+}
+
+void queue_read(ring_t& ring, ring_t::file_t* file) {
+  auto& sqe = next_sqe(ring, file);
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = file->fd;
+  sqe.addr =
+    reinterpret_cast<uint64_t>(file->request.buffer.data.get() + file->filled);
+  sqe.len = static_cast<uint32_t>(file->request.buffer.capacity - file->filled);
+  sqe.off = file->filled;
+}
+
+// handles the completions available, queueing the next read of files that
+// are not done and passing the others to on_read
+void reap_completions(read_queue_t& queue) {
+  auto& ring = *queue.ring;
+  unsigned head = *ring.cq_head;
+  const unsigned tail =
+    std::atomic_ref(*ring.cq_tail).load(std::memory_order_acquire);
+  for (; head != tail; head++) {
+    const auto& cqe = ring.cqes[head & ring.cq_mask];
+    auto* file = reinterpret_cast<ring_t::file_t*>(cqe.user_data);
+    const int result = cqe.res;
+    int error = 0;
+    bool done = false;
+    if (file->fd < 0) {
+      if (result < 0) {
+        error = -result;
+        done = true;
+      } else {
+        file->fd = result;
+        if (too_large_to_read(file->fd)) {
+          file->filled = max_read_size + 1;
+          done = true;
+        } else {
+          grow_buffer(file->request.buffer, 0);
+        }
+      }
+    } else if (result == -EINTR || result == -EAGAIN) {
+      // retried below
+    } else if (result < 0) {
+      error = -result;
+      done = true;
+    } else if (result == 0) {
+      done = true;
+    } else {
+      file->filled += result;
+      if (!grow_buffer(file->request.buffer, file->filled)) {
+        file->filled = max_read_size + 1;
+        done = true;
+      }
+    }
+    if (!done) {
+      queue_read(ring, file);
+      continue;
+    }
+    if (file->fd >= 0) {
+      close(file->fd);
+    }
+    const auto owned = std::ranges::find(
+      ring.files, file, &std::unique_ptr<ring_t::file_t>::get);
+    std::swap(*owned, ring.files.back());
+    const auto finished = std::move(ring.files.back());
+    ring.files.pop_back();
+    queue.on_read(finish_read(finished->request, error, finished->filled));
+  }
+  std::atomic_ref(*ring.cq_head).store(head, std::memory_order_release);
+}
+
+// waits for and handles at least one completion, false if the ring failed
+bool ring_wait(read_queue_t& queue) {
+  if (const int error = ring_submit(*queue.ring, 1); error != 0) {
+    fail_ring(queue, error);
+    return false;
+  }
+  reap_completions(queue);
+  return true;
+}
+
+// false if the ring failed before the read could be queued
+bool ring_submit_read(read_queue_t& queue, read_request_t& request) {
+  auto& ring = *queue.ring;
+  reap_completions(queue);
+  while (std::ssize(ring.files) >= queue.depth) {
+    if (!ring_wait(queue)) {
+      return false;
+    }
+  }
+  auto* file = ring.files
+                 .emplace_back(std::make_unique<ring_t::file_t>(
+                   ring_t::file_t{.request = std::move(request)}))
+                 .get();
+  auto& sqe = next_sqe(ring, file);
+  sqe.opcode = IORING_OP_OPENAT;
+  sqe.fd = AT_FDCWD;
+  sqe.addr = reinterpret_cast<uint64_t>(file->request.path.c_str());
+  sqe.open_flags = O_RDONLY | O_CLOEXEC;
+  // opens are passed on in small batches as files are found
+  if (ring.to_submit >= 8) {
+    if (const int error = ring_submit(ring, 0); error != 0) {
+      fail_ring(queue, error);
+    }
+  }
+  return true;
+}
+
+void ring_drain(read_queue_t& queue) {
+  reap_completions(queue);
+  while (!queue.ring->files.empty()) {
+    if (!ring_wait(queue)) {
+      return;
+    }
+  }
+}
+
+} // namespace
+
+#else
+
+// io_uring is never available, so this is never created
+struct read_queue_t::ring_t {};
+
+#endif
+
+read_queue_t::read_queue_t(
+  const read_backend_e backend, const int depth, on_read_t on_read)
+  : backend(backend), depth(depth), on_read(std::move(on_read)) {
+}
+
+read_queue_t::~read_queue_t() {
+  drain_reads(*this);
+  if (threads) {
+    {
+      std::lock_guard lock(threads->mutex);
+      threads->stopping = true;
+    }
+    threads->requested.notify_all();
+    threads->threads.clear();
+  }
+}
+
+namespace {
+
+void start_threads(read_queue_t& queue) {
+  queue.threads = std::make_unique<read_queue_t::threads_t>();
+  auto& threads = *queue.threads;
+  for (int i = 0; i < queue.depth; i++) {
+    threads.threads.emplace_back([&queue, &threads] {
+      std::unique_lock lock(threads.mutex);
+      for (;;) {
+        threads.requested.wait(lock, [&threads] {
+          return threads.stopping || !threads.requests.empty();
+        });
+        if (threads.requests.empty()) {
+          return;
+        }
+        auto request = std::move(threads.requests.front());
+        threads.requests.pop_front();
+        lock.unlock();
+        queue.on_read(read_file(std::move(request)));
+        lock.lock();
+        threads.in_flight--;
+        threads.completed.notify_all();
+      }
+    });
+  }
+}
+
+} // namespace
+
+std::unique_ptr<read_queue_t> make_read_queue(
+  const read_backend_e backend, const int depth, on_read_t on_read) {
+  auto queue =
+    std::make_unique<read_queue_t>(backend, depth, std::move(on_read));
+  if (backend == read_backend_e::io_uring) {
+#if defined(GREP_HAVE_IO_URING)
+    queue->ring = make_ring(depth);
+#endif
+    return queue->ring ? std::move(queue) : nullptr;
+  }
+  start_threads(*queue);
+  return queue;
+}
+
+void submit_read(read_queue_t& queue, read_request_t request) {
+#if defined(GREP_HAVE_IO_URING)
+  if (
+    queue.ring && queue.ring->error == 0
+    && ring_submit_read(queue, request)) {
+    return;
+  }
+  if (!queue.threads) {
+    start_threads(queue);
+  }
+#endif
+  auto& threads = *queue.threads;
+  {
+    std::unique_lock lock(threads.mutex);
+    threads.completed.wait(
+      lock, [&] { return threads.in_flight < queue.depth; });
+    threads.in_flight++;
+    threads.requests.push_back(std::move(request));
+  }
+  threads.requested.notify_one();
+}
+
+void drain_reads(read_queue_t& queue) {
+#if defined(GREP_HAVE_IO_URING)
+  if (queue.ring && queue.ring->error == 0) {
+    ring_drain(queue);
+  }
+#endif
+  if (queue.threads) {
+    std::unique_lock lock(queue.threads->mutex);
+    queue.threads->completed.wait(
+      lock, [&queue] { return queue.threads->in_flight == 0; });
+  }
+}
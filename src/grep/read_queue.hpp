@@ -0,0 +1,80 @@
+#pragma once
+
+// reads whole files into memory with many opens and reads in flight, so
+// waiting on storage overlaps with matching. Uses io_uring where the kernel
+// supports it and a set of threads doing blocking reads otherwise (or once
+// the ring fails)
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+enum class read_backend_e { io_uring, threads };
+
+// memory for a file's contents, unlike a vector it is not zeroed when it
+// grows
+struct read_buffer_t {
+  std::unique_ptr<char[]> data;
+  std::size_t capacity = 0;
+  std::size_t size = 0;
+};
+
+struct read_request_t {
+  std::string path;
+  // passed back in the result
+  uint64_t tag = 0;
+  // filled from the start, grown as needed (pass a recycled buffer to avoid
+  // allocating)
+  read_buffer_t buffer;
+};
+
+struct read_result_t {
+  std::string path;
+  uint64_t tag = 0;
+  // errno of the failed open or read, 0 on success
+  int error = 0;
+  // false if the file is larger than max_read_size and was not read
+  bool complete = true;
+  // size is that of the file contents
+  read_buffer_t buffer;
+};
+
+// called once per request, on the thread submitting requests (io_uring) or
+// on a reading thread, in completion order
+using on_read_t = std::function<void(read_result_t)>;
+
+struct read_queue_t {
+  // state of each backend, defined with it
+  struct ring_t;
+  struct threads_t;
+
+  read_backend_e backend;
+  int depth;
+  on_read_t on_read;
+  std::unique_ptr<ring_t> ring;
+  std::unique_ptr<threads_t> threads;
+
+  read_queue_t(read_backend_e backend, int depth, on_read_t on_read);
+  read_queue_t(const read_queue_t&) = delete;
+  read_queue_t& operator=(const read_queue_t&) = delete;
+  // waits for the reads in flight
+  ~read_queue_t();
+};
+
+// nullptr if the backend is not available (io_uring on other systems or on
+// kernels without it or the operations used). depth is the number of files
+// read at once
+std::unique_ptr<read_queue_t> make_read_queue(
+  read_backend_e backend, int depth, on_read_t on_read);
+
+// files larger than this are left to the caller (to map instead)
+constexpr std::size_t max_read_size = 16 << 20;
+
+// starts reading a file, first waiting (and completing reads) while depth
+// files are being read
+void submit_read(read_queue_t& queue, read_request_t request);
+
+// blocks until every submitted read has completed
+void drain_reads(read_queue_t& queue);
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+#include "grep/byte_set.hpp"
+#include "grep/matcher.hpp"
+#include "grep/prefilter.hpp"
+
+inline const char* find_last_newline(const char* data, const std::size_t size) {
+#if defined(__GLIBC__)
+  return static_cast<const char*>(memrchr(data, '\n', size));
+#else
+  for (std::size_t i = size; i > 0; i--) {
+    if (data[i - 1] == '\n') {
+      return data + i - 1;
+    }
+  }
+  return nullptr;
+#endif
+}
+
+// line numbers and byte offsets of the lines passed to on_line, which are
+// asked about in order. Input is seen as a sequence of blocks (a mapped
+// file is a single block, a stream is read in many) and newlines are
+// counted in bulk between the lines asked about, not line by line. It is
+// told about the blocks the way scan_stream tells its observer
+struct line_counter_t {
+  // newlines are only counted when set
+  bool count_lines = false;
+  std::string_view block;
+  // of the start of block in the input
+  uint64_t block_offset = 0;
+  // newlines in block before counted have been counted
+  std::size_t counted = 0;
+  // of the line containing block[counted]
+  uint64_t line_number = 1;
+
+  // the first kept bytes of next were in the previous block
+  void begin_block(
+    const std::string_view next, const uint64_t offset,
+    const std::size_t kept = 0) {
+    block = next;
+    block_offset = offset;
+    counted = kept;
+  }
+
+  // counts the rest of the block before its memory is reused
+  void end_block() {
+    line_number_at(block.size());
+  }
+
+  std::size_t lines_to_keep() const {
+    return 0;
+  }
+
+  uint64_t line_number_at(const std::size_t pos) {
+    if (count_lines && pos >= counted) {
+      line_number +=
+        count_byte('\n', block.data() + counted, block.data() + pos);
+    } else if (count_lines) {
+      // context before a match, counted back over
+      line_number -=
+        count_byte('\n', block.data() + pos, block.data() + counted);
+    }
+    counted = pos;
+    return line_number;
+  }
+
+  // line is in block, usually at or after the lines asked about before
+  // (those before are counted back to, which is only cheap if they are
+  // close)
+  uint64_t line_number_of(const std::string_view line) {
+    return line_number_at(line.data() - block.data());
+  }
+
+  uint64_t offset_of(const std::string_view line) const {
+    return block_offset + (line.data() - block.data());
+  }
+};
+
+// scan_buffer without collecting stats
+template<typename on_line_t>
+std::size_t scan_candidates(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  const std::string_view buffer, on_line_t&& on_line) {
+  const auto& prefilter = compiled.prefilter;
+  const bool skip_to_first_byte =
+    prefilter.first_bytes && !prefilter.anchored_at_begin;
+  // next occurrence of each literal at or after pos
+  std::vector<std::size_t> literal_hits(prefilter.literals.size());
+  for (std::size_t i = 0; i < prefilter.literals.size(); i++) {
+    literal_hits[i] =
+      find_literal(buffer, prefilter.literals[i], prefilter.ignore_case);
+  }
+  for (std::size_t pos = 0; pos < buffer.size();) {
+    std::size_t candidate = pos;
+    if (!literal_hits.empty()) {
+      candidate = std::string_view::npos;
+      for (std::size_t i = 0; i < literal_hits.size(); i++) {
+        if (
+          literal_hits[i] != std::string_view::npos && literal_hits[i] < pos) {
+          const auto hit = find_literal(
+            buffer.substr(pos), prefilter.literals[i], prefilter.ignore_case);
+          literal_hits[i] = hit != std::string_view::npos ? pos + hit : hit;
+        }
+        candidate = std::min(candidate, literal_hits[i]);
+      }
+    } else if (compiled.literal_set) {
+      candidate = find_in_literal_set(*compiled.literal_set, buffer, pos);
+    } else if (skip_to_first_byte) {
+      const char* buffer_end = buffer.data() + buffer.size();
+      const char* found =
+        find_byte(*prefilter.first_bytes, buffer.data() + pos, buffer_end);
+      candidate =
+        found != buffer_end ? found - buffer.data() : std::string_view::npos;
+    }
+    if (candidate == std::string_view::npos) {
+      break;
+    }
+    const char* newline_before =
+      find_last_newline(buffer.data() + pos, candidate - pos);
+    const auto line_begin =
+      newline_before != nullptr ? newline_before - buffer.data() + 1 : pos;
+    const void* newline_after = std::memchr(
+      buffer.data() + candidate, '\n', buffer.size() - candidate);
+    const auto line_end =
+      newline_after != nullptr
+        ? static_cast<const char*>(newline_after) - buffer.data()
+        : buffer.size();
+    const auto line = buffer.substr(line_begin, line_end - line_begin);
+    // a literal set candidate is a match, other candidates are checked
+    const bool matched =
+      compiled.literal_set || matches(compiled, scratch, line);
+    if (matched && !on_line(line)) {
+      return std::min(line_end + 1, buffer.size());
+    }
+    pos = line_end + 1;
+  }
+  return buffer.size();
+}
+
+// calls on_line with every line in buffer matching the pattern, when the
+// prefilter can locate candidates the buffer is searched as a whole and line
+// boundaries are only found around each candidate. on_line returns false to
+// stop the scan, the offset just past the last line scanned is returned
+template<typename on_line_t>
+std::size_t scan_buffer(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  const std::string_view buffer, on_line_t&& on_line) {
+  auto* stats = scratch.stats.get();
+  if (stats == nullptr) {
+    return scan_candidates(compiled, scratch, buffer, on_line);
+  }
+  const auto started = std::chrono::steady_clock::now();
+  uint64_t matched = 0;
+  const auto scanned = scan_candidates(
+    compiled, scratch, buffer, [&matched, &on_line](std::string_view line) {
+      matched++;
+      return on_line(line);
+    });
+  stats->scan_time += std::chrono::steady_clock::now() - started;
+  stats->bytes_scanned += scanned;
+  stats->lines_scanned +=
+    count_byte('\n', buffer.data(), buffer.data() + scanned)
+    + (scanned > 0 && buffer[scanned - 1] != '\n' ? 1 : 0);
+  stats->matched_lines += matched;
+  if (compiled.literal_set) {
+    // literal set candidates are matches and are not checked with matches
+    stats->candidate_lines += matched;
+  }
+  return scanned;
+}
+
+// scans input that is not in memory as a whole in large blocks, read
+// (data, size) fills the next bytes like read(2) (returning 0 at the end).
+// Lines passed to on_line are only valid until it returns (and it returns
+// false to stop reading). blocks, if not null, observes the blocks:
+// begin_block(block, offset in the input, kept) is called before the lines
+// of a block are scanned and end_block() after, while it is still
+// readable. The last blocks->lines_to_keep() lines of a block stay
+// readable at the start of the next one (its first kept bytes, which are
+// not scanned again)
+template<
+  typename read_t, typename on_line_t, typename blocks_t = line_counter_t>
+void scan_blocks(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  read_t&& read, on_line_t&& on_line, blocks_t* blocks = nullptr) {
+  constexpr std::size_t block_size = 1 << 20;
+  std::vector<char> buffer(block_size);
+  std::size_t filled = 0;
+  // of the start of buffer in the input
+  uint64_t offset = 0;
+  std::size_t kept = 0;
+  for (;;) {
+    if (filled == buffer.size()) {
+      // a single line is longer than the buffer
+      buffer.resize(buffer.size() * 2);
+    }
+    const auto started = scratch.stats
+                         ? std::chrono::steady_clock::now()
+                         : std::chrono::steady_clock::time_point();
+    const auto bytes_read =
+      read(buffer.data() + filled, buffer.size() - filled);
+    if (scratch.stats) {
+      scratch.stats->read_time += std::chrono::steady_clock::now() - started;
+    }
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      break;
+    }
+    const char* last_newline =
+      find_last_newline(buffer.data() + filled, bytes_read);
+    filled += bytes_read;
+    if (last_newline == nullptr) {
+      continue;
+    }
+    const std::string_view block(
+      buffer.data(), last_newline - buffer.data() + 1);
+    if (blocks != nullptr) {
+      blocks->begin_block(block, offset, kept);
+    }
+    // on_line may stop the scan at the last line of the block
+    bool stopped = false;
+    scan_buffer(
+      compiled, scratch, block.substr(kept),
+      [&on_line, &stopped](const std::string_view line) {
+        stopped = !on_line(line);
+        return !stopped;
+      });
+    if (blocks != nullptr) {
+      blocks->end_block();
+    }
+    if (stopped) {
+      return;
+    }
+    // where the lines to keep start
+    std::size_t keep = block.size();
+    for (std::size_t lines = blocks != nullptr ? blocks->lines_to_keep() : 0;
+         lines > 0 && keep > 0; lines--) {
+      const char* newline = find_last_newline(block.data(), keep - 1);
+      keep = newline != nullptr ? newline - block.data() + 1 : 0;
+    }
+    kept = block.size() - keep;
+    offset += keep;
+    std::memmove(buffer.data(), buffer.data() + keep, filled - keep);
+    filled -= keep;
+  }
+  if (filled > kept) {
+    const std::string_view block(buffer.data(), filled);
+    if (blocks != nullptr) {
+      blocks->begin_block(block, offset, kept);
+    }
+    scan_buffer(compiled, scratch, block.substr(kept), on_line);
+    if (blocks != nullptr) {
+      blocks->end_block();
+    }
+  }
+}
+
+// scans input that cannot be mapped (pipes, stdin), see scan_blocks
+template<typename on_line_t, typename blocks_t = line_counter_t>
+void scan_stream(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch, const int fd,
+  on_line_t&& on_line, blocks_t* blocks = nullptr) {
+  scan_blocks(
+    compiled, scratch,
+    [fd](char* data, const std::size_t size) { return read(fd, data, size); },
+    on_line, blocks);
+}
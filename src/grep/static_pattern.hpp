@@ -0,0 +1,687 @@
+#pragma once
+
+// patterns fixed at build time: static_pattern_t<"pattern"> parses the
+// pattern with the grammar of parse_pattern, compiles it to the same kind of
+// program and runs the subset construction of the lazy dfa while compiling,
+// leaving a transition table over byte classes. Matching is then a loop
+// over the input with nothing to interpret, allocate or build. Patterns with
+// backreferences (and malformed patterns) fail to compile
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "grep/byte_set.hpp"
+#include "grep/pattern.hpp"
+#include "grep/prefilter.hpp"
+#include "grep/program.hpp"
+
+// a string literal usable as a template argument
+template<std::size_t size>
+struct static_string_t {
+  char text[size]{};
+
+  constexpr static_string_t(const char (&literal)[size]) {
+    std::copy_n(literal, size, text);
+  }
+
+  constexpr std::string_view view() const {
+    return {text, size - 1};
+  }
+};
+
+// everything below up to static_pattern_t only runs during compilation, a
+// throw there is a compile error pointing at the problem
+using static_byte_set_t = std::array<bool, 256>;
+
+enum class static_token_e { byte, byte_set, any, group, begin, end };
+
+struct static_token_t {
+  static_token_e kind;
+  char byte = 0;
+  // into static_parse_t::byte_sets or static_parse_t::groups
+  int index = 0;
+  std::optional<quantifier_t> quantifier;
+};
+
+// groups[0] is the whole pattern, every group is a list of alternatives
+struct static_parse_t {
+  std::vector<std::vector<std::vector<static_token_t>>> groups;
+  std::vector<static_byte_set_t> byte_sets;
+};
+
+constexpr int static_add_byte_set(
+  static_parse_t& parsed, const std::string_view characters,
+  const bool negated) {
+  static_byte_set_t byte_set{};
+  for (std::size_t i = 0; i < characters.size(); i++) {
+    const auto first = static_cast<unsigned char>(characters[i]);
+    if (i + 2 < characters.size() && characters[i + 1] == '-') {
+      const auto last = static_cast<unsigned char>(characters[i + 2]);
+      for (int c = first; c <= last; c++) {
+        byte_set[c] = true;
+      }
+      i += 2;
+    } else {
+      byte_set[first] = true;
+    }
+  }
+  if (negated) {
+    for (auto& member : byte_set) {
+      member = !member;
+    }
+  }
+  parsed.byte_sets.push_back(byte_set);
+  return static_cast<int>(parsed.byte_sets.size()) - 1;
+}
+
+constexpr bool static_is_digit(const char c) {
+  return c >= '0' && c <= '9';
+}
+
+// the same grammar as parse_pattern, returns the index of the group holding
+// the pattern's alternatives
+constexpr int static_parse_pattern(
+  static_parse_t& parsed, const std::string_view pattern) {
+  const int group = static_cast<int>(parsed.groups.size());
+  parsed.groups.emplace_back();
+  std::vector<std::vector<static_token_t>> alternatives;
+  std::vector<static_token_t> tokens;
+  const bool anchored_beginning = !pattern.empty() && pattern.front() == '^';
+  if (anchored_beginning) {
+    tokens.push_back({.kind = static_token_e::begin});
+  }
+  const bool anchored_end = pattern.size() >= 2
+                         && pattern[pattern.size() - 2] != '\\'
+                         && pattern.back() == '$';
+  const std::size_t end = anchored_end ? pattern.size() - 1 : pattern.size();
+  // quantifiers on anchors are ignored, like set_quantifier does
+  const auto set_quantifier = [&tokens](const quantifier_t quantifier) {
+    if (tokens.empty()) {
+      throw std::runtime_error("Quantifier without a token");
+    }
+    if (
+      tokens.back().kind != static_token_e::begin
+      && tokens.back().kind != static_token_e::end) {
+      tokens.back().quantifier = quantifier;
+    }
+  };
+  for (std::size_t p = anchored_beginning ? 1 : 0; p < end;) {
+    const char c = pattern[p];
+    if (c == '+') {
+      set_quantifier(one_or_more_t{});
+      p++;
+    } else if (c == '?') {
+      set_quantifier(zero_or_one_t{});
+      p++;
+    } else if (c == '*') {
+      set_quantifier(zero_or_more_t{});
+      p++;
+    } else if (c == '{') {
+      int times = 0;
+      std::size_t digit = p + 1;
+      for (; digit < pattern.size() && static_is_digit(pattern[digit]);
+           digit++) {
+        times = times * 10 + (pattern[digit] - '0');
+      }
+      if (digit == p + 1 || digit == pattern.size() || pattern[digit] != '}') {
+        throw std::runtime_error("Expected a count in {}");
+      }
+      set_quantifier(n_times_t{.n_times = times});
+      p = digit + 1;
+    } else if (c == '.') {
+      tokens.push_back({.kind = static_token_e::any});
+      p++;
+    } else if (c == '\\') {
+      if (p + 1 == pattern.size()) {
+        throw std::runtime_error("Trailing backslash");
+      }
+      const char escaped = pattern[p + 1];
+      if (escaped == 'd') {
+        tokens.push_back(
+          {.kind = static_token_e::byte_set,
+           .index = static_add_byte_set(parsed, "0-9", false)});
+      } else if (escaped == 'w') {
+        tokens.push_back(
+          {.kind = static_token_e::byte_set,
+           .index = static_add_byte_set(parsed, "a-zA-Z0-9_", false)});
+      } else if (static_is_digit(escaped)) {
+        throw std::runtime_error("Backreferences need the runtime engine");
+      } else {
+        // any other escaped character (including \) stands for itself
+        tokens.push_back({.kind = static_token_e::byte, .byte = escaped});
+      }
+      p += 2;
+    } else if (c == '[') {
+      const bool negated = p + 1 < pattern.size() && pattern[p + 1] == '^';
+      const auto offset = p + (negated ? 2 : 1);
+      const auto close = pattern.find(']', offset);
+      if (close == std::string_view::npos) {
+        throw std::runtime_error("Unterminated character group");
+      }
+      tokens.push_back(
+        {.kind = static_token_e::byte_set,
+         .index = static_add_byte_set(
+           parsed, pattern.substr(offset, close - offset), negated)});
+      p = close + 1;
+    } else if (c == '(') {
+      std::size_t close = p + 1;
+      for (int nesting_depth = 0;; close++) {
+        if (close == pattern.size()) {
+          throw std::runtime_error("Unterminated capture group");
+        }
+        if (pattern[close] == '(') {
+          nesting_depth++;
+        } else if (pattern[close] == ')' && nesting_depth-- == 0) {
+          break;
+        }
+      }
+      const int sub_group =
+        static_parse_pattern(parsed, pattern.substr(p + 1, close - p - 1));
+      tokens.push_back({.kind = static_token_e::group, .index = sub_group});
+      p = close + 1;
+    } else if (c == '|') {
+      alternatives.push_back(std::move(tokens));
+      tokens.clear();
+      p++;
+    } else {
+      tokens.push_back({.kind = static_token_e::byte, .byte = c});
+      p++;
+    }
+  }
+  if (anchored_end) {
+    tokens.push_back({.kind = static_token_e::end});
+  }
+  if (!tokens.empty()) {
+    alternatives.push_back(std::move(tokens));
+  }
+  parsed.groups[group] = std::move(alternatives);
+  return group;
+}
+
+// a program as compile_program emits it, without save instructions as there
+// are no captures to record
+struct static_program_t {
+  std::vector<instruction_t> instructions;
+  std::vector<static_byte_set_t> byte_sets;
+  // text every match contains, checked before running the automaton (a
+  // vector as GCC 12 mishandles copies of short strings in constant
+  // evaluation)
+  std::vector<char> required_literal;
+
+  constexpr int emit(const instruction_t instruction) {
+    instructions.push_back(instruction);
+    return static_cast<int>(instructions.size()) - 1;
+  }
+
+  constexpr int next_pc() const {
+    return static_cast<int>(instructions.size());
+  }
+
+  constexpr bool matches_byte(
+    const instruction_t& instruction, const unsigned char c) const {
+    switch (instruction.op) {
+      case opcode_e::byte:
+        return instruction.arg == c;
+      case opcode_e::byte_set:
+        return byte_sets[instruction.x][c];
+      case opcode_e::any:
+        return true;
+      default:
+        return false;
+    }
+  }
+};
+
+constexpr void static_emit_alternatives(
+  static_program_t& program, const static_parse_t& parsed, int group);
+
+constexpr void static_emit_token(
+  static_program_t& program, const static_parse_t& parsed,
+  const static_token_t& token) {
+  switch (token.kind) {
+    case static_token_e::byte:
+      program.emit(
+        {.op = opcode_e::byte, .arg = static_cast<uint8_t>(token.byte)});
+      break;
+    case static_token_e::byte_set:
+      program.byte_sets.push_back(parsed.byte_sets[token.index]);
+      program.emit(
+        {.op = opcode_e::byte_set,
+         .x = static_cast<int32_t>(program.byte_sets.size()) - 1});
+      break;
+    case static_token_e::any:
+      program.emit({.op = opcode_e::any});
+      break;
+    case static_token_e::group:
+      static_emit_alternatives(program, parsed, token.index);
+      break;
+    case static_token_e::begin:
+      program.emit({.op = opcode_e::begin});
+      break;
+    case static_token_e::end:
+      program.emit({.op = opcode_e::end});
+      break;
+  }
+}
+
+// the layout of program_compiler_t::emit_quantified_token
+constexpr void static_emit_quantified_token(
+  static_program_t& program, const static_parse_t& parsed,
+  const static_token_t& token) {
+  const auto& quantifier = token.quantifier;
+  if (!quantifier) {
+    static_emit_token(program, parsed, token);
+  } else if (const auto* n_times = std::get_if<n_times_t>(&*quantifier)) {
+    for (int i = 0; i < n_times->n_times; i++) {
+      static_emit_token(program, parsed, token);
+    }
+  } else if (std::holds_alternative<zero_or_one_t>(*quantifier)) {
+    const int split = program.emit({.op = opcode_e::split});
+    static_emit_token(program, parsed, token);
+    program.instructions[split].x = split + 1;
+    program.instructions[split].y = program.next_pc();
+  } else if (std::holds_alternative<zero_or_more_t>(*quantifier)) {
+    const int split = program.emit({.op = opcode_e::split});
+    static_emit_token(program, parsed, token);
+    program.emit({.op = opcode_e::jump, .x = split});
+    program.instructions[split].x = split + 1;
+    program.instructions[split].y = program.next_pc();
+  } else {
+    const int body = program.next_pc();
+    static_emit_token(program, parsed, token);
+    program.emit(
+      {.op = opcode_e::split, .x = body, .y = program.next_pc() + 1});
+  }
+}
+
+constexpr void static_emit_alternatives(
+  static_program_t& program, const static_parse_t& parsed, const int group) {
+  const auto& alternatives = parsed.groups[group];
+  std::vector<int> jumps_to_end;
+  for (std::size_t i = 0; i < alternatives.size(); i++) {
+    int split = -1;
+    if (i + 1 < alternatives.size()) {
+      split = program.emit({.op = opcode_e::split});
+      program.instructions[split].x = program.next_pc();
+    }
+    for (const auto& token : alternatives[i]) {
+      static_emit_quantified_token(program, parsed, token);
+    }
+    if (split >= 0) {
+      jumps_to_end.push_back(program.emit({.op = opcode_e::jump}));
+      program.instructions[split].y = program.next_pc();
+    }
+  }
+  for (const int jump : jumps_to_end) {
+    program.instructions[jump].x = program.next_pc();
+  }
+}
+
+// the longest run of literals a pattern without alternatives cannot match
+// without, a simpler form of the required literals of make_prefilter. A
+// prefix is left out as skipping to its first byte finds it as fast
+constexpr std::vector<char> static_required_literal(
+  const static_parse_t& parsed) {
+  if (parsed.groups[0].size() != 1) {
+    return {};
+  }
+  std::vector<char> best;
+  bool best_is_prefix = false;
+  std::vector<char> run;
+  bool run_is_prefix = true;
+  const auto consider = [&] {
+    if (run.size() > best.size()) {
+      best.assign(run.begin(), run.end());
+      best_is_prefix = run_is_prefix;
+    }
+    run.clear();
+    run_is_prefix = false;
+  };
+  for (const auto& token : parsed.groups[0].front()) {
+    if (
+      token.kind == static_token_e::begin
+      || token.kind == static_token_e::end) {
+      // zero width, the run continues
+      continue;
+    }
+    if (token.kind != static_token_e::byte) {
+      consider();
+      continue;
+    }
+    const auto& quantifier = token.quantifier;
+    if (!quantifier) {
+      run.push_back(token.byte);
+    } else if (const auto* n_times = std::get_if<n_times_t>(&*quantifier)) {
+      run.insert(run.end(), n_times->n_times, token.byte);
+    } else if (std::holds_alternative<one_or_more_t>(*quantifier)) {
+      // further repeats may follow
+      run.push_back(token.byte);
+      consider();
+    } else {
+      consider();
+    }
+  }
+  consider();
+  if (best_is_prefix) {
+    best.clear();
+  }
+  return best;
+}
+
+constexpr static_program_t static_compile_pattern(
+  const std::string_view pattern) {
+  static_parse_t parsed;
+  static_parse_pattern(parsed, pattern);
+  static_program_t program;
+  static_emit_alternatives(program, parsed, 0);
+  program.emit({.op = opcode_e::match});
+  program.required_literal = static_required_literal(parsed);
+  return program;
+}
+
+// subset construction over the whole program, as in lazy_dfa_t. Sets of
+// program counters are bit vectors as constant evaluation is slow enough
+// for the cost of building the automaton to be noticeable
+struct static_dfa_builder_t {
+  static constexpr int max_states = 1024;
+
+  struct flags_e {
+    enum : uint8_t { match = 1 << 0, match_at_end = 1 << 1, dead = 1 << 2 };
+  };
+
+  using pc_set_t = std::vector<uint64_t>;
+
+  static_program_t program;
+  // bytes no consuming instruction tells apart share a class
+  std::array<uint8_t, 256> byte_classes{};
+  int class_count = 0;
+  std::vector<pc_set_t> state_sets;
+  // next state by state * class_count + class
+  std::vector<int> transitions;
+  std::vector<uint8_t> flags;
+  // the state between matches of an unanchored search (-1 if it cannot be
+  // skipped through) and the bytes leaving it
+  int skip_state = -1;
+  static_byte_set_t skip_bytes{};
+
+  constexpr pc_set_t empty_set() const {
+    return pc_set_t((program.instructions.size() + 63) / 64);
+  }
+
+  template<typename on_pc_t>
+  static constexpr void for_each_pc(const pc_set_t& set, on_pc_t&& on_pc) {
+    for (std::size_t word = 0; word < set.size(); word++) {
+      for (uint64_t bits = set[word]; bits != 0; bits &= bits - 1) {
+        on_pc(static_cast<int>(word * 64 + std::countr_zero(bits)));
+      }
+    }
+  }
+
+  // the byte consuming, end and match instructions reachable from pc
+  constexpr pc_set_t closure(
+    const int pc, const bool at_begin, const bool at_end) const {
+    pc_set_t set = empty_set();
+    std::vector<bool> visited(program.instructions.size());
+    std::vector<int> stack{pc};
+    while (!stack.empty()) {
+      const int next = stack.back();
+      stack.pop_back();
+      if (visited[next]) {
+        continue;
+      }
+      visited[next] = true;
+      const auto& instruction = program.instructions[next];
+      switch (instruction.op) {
+        case opcode_e::split:
+          stack.push_back(instruction.y);
+          stack.push_back(instruction.x);
+          break;
+        case opcode_e::jump:
+          stack.push_back(instruction.x);
+          break;
+        case opcode_e::begin:
+          if (at_begin) {
+            stack.push_back(next + 1);
+          }
+          break;
+        case opcode_e::end:
+          if (at_end) {
+            stack.push_back(next + 1);
+            break;
+          }
+          [[fallthrough]];
+        default:
+          set[next / 64] |= uint64_t{1} << (next % 64);
+          break;
+      }
+    }
+    return set;
+  }
+
+  constexpr int add_state(const pc_set_t& set) {
+    for (std::size_t i = 0; i < state_sets.size(); i++) {
+      if (state_sets[i] == set) {
+        return static_cast<int>(i);
+      }
+    }
+    if (state_sets.size() == max_states) {
+      throw std::runtime_error("Pattern needs too many dfa states");
+    }
+    uint8_t state_flags = 0;
+    for_each_pc(set, [this, &state_flags](const int pc) {
+      const auto op = program.instructions[pc].op;
+      if (op == opcode_e::match) {
+        state_flags |= flags_e::match | flags_e::match_at_end;
+      } else if (op == opcode_e::end) {
+        for_each_pc(closure(pc, false, true), [&](const int end_pc) {
+          if (program.instructions[end_pc].op == opcode_e::match) {
+            state_flags |= flags_e::match_at_end;
+          }
+        });
+      }
+    });
+    state_sets.push_back(set);
+    flags.push_back(state_flags);
+    transitions.resize(transitions.size() + class_count, 0);
+    return static_cast<int>(state_sets.size()) - 1;
+  }
+
+  // starts from a single class and splits classes by every consuming
+  // instruction in turn
+  constexpr void assign_byte_classes() {
+    class_count = 1;
+    for (const auto& instruction : program.instructions) {
+      if (instruction.op == opcode_e::byte) {
+        // only the byte itself can leave its class
+        const int byte = instruction.arg;
+        for (int c = 0; c < 256; c++) {
+          if (c != byte && byte_classes[c] == byte_classes[byte]) {
+            byte_classes[byte] = static_cast<uint8_t>(class_count++);
+            break;
+          }
+        }
+        continue;
+      }
+      if (instruction.op != opcode_e::byte_set) {
+        continue;
+      }
+      // per old class, the new class of its bytes outside and inside the set
+      std::vector<std::array<int, 2>> split(class_count, {-1, -1});
+      int count = 0;
+      for (int c = 0; c < 256; c++) {
+        int& target =
+          split[byte_classes[c]][program.matches_byte(instruction, c)];
+        if (target < 0) {
+          target = count++;
+        }
+        byte_classes[c] = static_cast<uint8_t>(target);
+      }
+      class_count = count;
+    }
+  }
+
+  // state 0 is dead and state 1 the start state
+  constexpr void build() {
+    assign_byte_classes();
+    add_state(empty_set());
+    flags[0] = flags_e::dead;
+    add_state(closure(0, true, false));
+    // a byte standing for each class
+    std::vector<int> representatives(class_count);
+    for (int c = 255; c >= 0; c--) {
+      representatives[byte_classes[c]] = c;
+    }
+    // closures distribute over unions so the closure of a step is the union
+    // of closures computed once per program counter
+    std::vector<pc_set_t> closures;
+    for (std::size_t pc = 0; pc < program.instructions.size(); pc++) {
+      closures.push_back(closure(static_cast<int>(pc), false, false));
+    }
+    // added before the loop below so its transitions are filled in
+    const int mid_start = add_state(closures[0]);
+    for (std::size_t state = 1; state < state_sets.size(); state++) {
+      for (int byte_class = 0; byte_class < class_count; byte_class++) {
+        const int c = representatives[byte_class];
+        // unanchored, a match can start at every position
+        pc_set_t next = closures[0];
+        for_each_pc(state_sets[state], [&](const int pc) {
+          if (program.matches_byte(program.instructions[pc], c)) {
+            for (std::size_t word = 0; word < next.size(); word++) {
+              next[word] |= closures[pc + 1][word];
+            }
+          }
+        });
+        const int target = add_state(next);
+        transitions[state * class_count + byte_class] = target;
+      }
+    }
+    // as for prefilter_t::first_bytes, large sets are not worth skipping to
+    int escapes = 0;
+    for (int c = 0; c < 256; c++) {
+      skip_bytes[c] =
+        transitions[mid_start * class_count + byte_classes[c]] != mid_start;
+      escapes += skip_bytes[c] ? 1 : 0;
+    }
+    if (mid_start != 0 && escapes <= prefilter_t::max_first_bytes) {
+      skip_state = mid_start;
+    }
+  }
+};
+
+constexpr static_dfa_builder_t build_static_dfa(
+  const std::string_view pattern) {
+  static_dfa_builder_t builder{.program = static_compile_pattern(pattern)};
+  builder.build();
+  return builder;
+}
+
+// the matcher static_pattern_t is built around, with tables of the sizes the
+// pattern needs
+template<
+  std::size_t state_count, std::size_t class_count, std::size_t literal_size>
+struct static_dfa_t {
+  using flags_e = static_dfa_builder_t::flags_e;
+  using state_t = std::conditional_t<state_count <= 256, uint8_t, uint16_t>;
+
+  std::array<uint8_t, 256> byte_classes{};
+  std::array<state_t, state_count * class_count> transitions{};
+  std::array<uint8_t, state_count> flags{};
+  int skip_state = -1;
+  static_byte_set_t skip_bytes{};
+  std::array<char, literal_size> required_literal{};
+
+  // returns true if the pattern matches anywhere in input. skip_scanner
+  // finds skip_bytes, it is null during constant evaluation
+  constexpr bool search(
+    const std::string_view input,
+    const byte_scanner_t* const skip_scanner) const {
+    int state = 1;
+    if ((flags[state] & flags_e::match) != 0) {
+      return true;
+    }
+    const char* pos = input.data();
+    const char* const end = input.data() + input.size();
+    while (pos != end) {
+      if (state == skip_state && skip_scanner != nullptr) {
+        if ((pos = find_byte(*skip_scanner, pos, end)) == end) {
+          break;
+        }
+      }
+      const auto c = static_cast<unsigned char>(*pos++);
+      state = transitions[state * class_count + byte_classes[c]];
+      if ((flags[state] & (flags_e::match | flags_e::dead)) != 0) {
+        return flags[state] != flags_e::dead;
+      }
+    }
+    return (flags[state] & flags_e::match_at_end) != 0;
+  }
+};
+
+template<static_string_t pattern>
+constexpr auto make_static_dfa() {
+  // the builder cannot outlive constant evaluation, so it runs once for the
+  // table sizes and once more to fill them
+  constexpr auto sizes = [] {
+    const auto builder = build_static_dfa(pattern.view());
+    return std::array<std::size_t, 3>{
+      builder.state_sets.size(), static_cast<std::size_t>(builder.class_count),
+      builder.program.required_literal.size()};
+  }();
+  const auto builder = build_static_dfa(pattern.view());
+  static_dfa_t<sizes[0], sizes[1], sizes[2]> dfa;
+  std::ranges::copy(
+    builder.program.required_literal, dfa.required_literal.begin());
+  dfa.byte_classes = builder.byte_classes;
+  dfa.skip_state = builder.skip_state;
+  dfa.skip_bytes = builder.skip_bytes;
+  std::ranges::copy(builder.transitions, dfa.transitions.begin());
+  std::ranges::copy(builder.flags, dfa.flags.begin());
+  return dfa;
+}
+
+// a pattern compiled to a dfa during compilation, for example
+//   if (static_pattern_t<"\\d+ apples?">::matches(line)) { ... }
+// matches the same lines as compile_patterns({pattern}, false) would
+template<static_string_t pattern>
+struct static_pattern_t {
+  static constexpr auto dfa = make_static_dfa<pattern>();
+
+  // built on first use as byte_scanner_t picks its kernel at run time
+  static const byte_scanner_t* skip_scanner() {
+    if (dfa.skip_state < 0) {
+      return nullptr;
+    }
+    static const byte_scanner_t scanner = [] {
+      byte_set_t byte_set;
+      for (int c = 0; c < 256; c++) {
+        byte_set[c] = dfa.skip_bytes[c];
+      }
+      return make_byte_scanner(byte_set);
+    }();
+    return &scanner;
+  }
+
+  // returns true if the pattern matches anywhere in input (a single line)
+  static constexpr bool matches(const std::string_view input) {
+    if consteval {
+      return dfa.search(input, nullptr);
+    } else {
+      const std::string_view literal(
+        dfa.required_literal.data(), dfa.required_literal.size());
+      if (
+        !literal.empty()
+        && find_literal(input, literal) == std::string_view::npos) {
+        return false;
+      }
+      return dfa.search(input, skip_scanner());
+    }
+  }
+};
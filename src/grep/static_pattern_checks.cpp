@@ -0,0 +1,91 @@
+// static_pattern_t parses and compiles patterns with its own constexpr copy
+// of the grammar, these pin it to the answers tests.sh expects from the
+// runtime engine (the accept and reject cases without backreferences) so
+// the two cannot drift apart without the build failing
+
+#include <string_view>
+
+#include "grep/static_pattern.hpp"
+
+namespace {
+
+template<static_string_t pattern>
+constexpr bool static_matches(const std::string_view input) {
+  return static_pattern_t<pattern>::matches(input);
+}
+
+static_assert(static_matches<"is">("this is great"));
+static_assert(static_matches<"17">("where is the number 17 in this string"));
+static_assert(static_matches<"\\w">("APPLE"));
+static_assert(static_matches<"[abc]">("apple"));
+static_assert(static_matches<"[123]">("a1b2c3"));
+static_assert(static_matches<"colou?r">("colour"));
+static_assert(static_matches<"[^abc]">("apple"));
+static_assert(!static_matches<"[^anb]">("banana"));
+static_assert(!static_matches<"[acdfghijk]">("blueberry"));
+static_assert(!static_matches<"[orange]">("[]"));
+static_assert(static_matches<"[^opq]q\\\\">("orangeq\\"));
+static_assert(static_matches<"^orange">("orange_pear"));
+static_assert(!static_matches<"^orange">("pear_orange"));
+static_assert(static_matches<"a\\d+">("helloa123"));
+static_assert(static_matches<"\\d \\w\\w\\ws">("sally has 3 dogs"));
+static_assert(!static_matches<"\\d \\w\\w\\ws">("sally has 1 dog"));
+static_assert(static_matches<"a[123]+123">("a123123123123"));
+static_assert(!static_matches<"a123$">("aaaxbbbacy"));
+static_assert(static_matches<"pear$">("pineapple_pear"));
+static_assert(!static_matches<"pear$">("pear_pineapple"));
+static_assert(!static_matches<"^banana$">("banana_banana"));
+static_assert(static_matches<"^abc">("abcthisisabc"));
+static_assert(!static_matches<"^[jmav]+">("thisisajvm"));
+static_assert(static_matches<"this$">("thisisnotthis"));
+static_assert(static_matches<"ca+aars">("caaars"));
+static_assert(static_matches<"d">("dog"));
+static_assert(static_matches<"^strawberry$">("strawberry"));
+static_assert(static_matches<"^abc_\\d+_xyz$">("abc_123_xyz"));
+static_assert(!static_matches<"^abc_\\d+_xyz$">("abc_rst_xyz"));
+static_assert(static_matches<"ca+t">("cat"));
+static_assert(static_matches<"ca?t">("cat"));
+static_assert(static_matches<"ca?t">("act"));
+static_assert(static_matches<"ca?a?t">("cat"));
+static_assert(!static_matches<"ca?t">("cag"));
+static_assert(static_matches<"red|blue|green">("blue"));
+static_assert(!static_matches<"I like (cats|dogs)">("I like fish"));
+static_assert(static_matches<"I like (cats|dogs)+">("I like catsdogscatsdogs"));
+static_assert(
+  static_matches<"I like (cats|dogs)? and parrots">("I like  and parrots"));
+static_assert(static_matches<"(red|blue|green)">("green"));
+static_assert(static_matches<"(cat|dog)">("doghouse"));
+static_assert(!static_matches<"a (cat|dog)">("a cog"));
+static_assert(static_matches<"^I see \\d+ (cat|dog)s?$">("I see 1 cat"));
+static_assert(!static_matches<"^I see \\d+ (cat|dog)s?$">("I see 2 dog3"));
+static_assert(static_matches<"g.+gol">("goøö0Ogol"));
+static_assert(!static_matches<"c.t">("car"));
+static_assert(static_matches<"c.t">("cat"));
+static_assert(!static_matches<"g.+gol">("gol"));
+static_assert(
+  static_matches<"(apple) (\\w+)">("pineapple pie, pineapple and pie"));
+static_assert(static_matches<"(something(hello|goodbye))">("somethinggoodbye"));
+static_assert(static_matches<"not ([^xyz]+),">("not efg, abc, or def"));
+static_assert(static_matches<"ca*t">("ct"));
+static_assert(static_matches<"ca*t">("caaat"));
+static_assert(!static_matches<"ca*t">("dog"));
+static_assert(static_matches<"k\\d*t">("kt"));
+static_assert(static_matches<"k\\d*t">("k1t"));
+static_assert(!static_matches<"k\\d*t">("kabct"));
+static_assert(static_matches<"k[abc]*t">("kt"));
+static_assert(static_matches<"k[abc]*t">("kat"));
+static_assert(static_matches<"k[abc]*t">("kabct"));
+static_assert(!static_matches<"k[abc]*t">("kaxyzt"));
+static_assert(static_matches<"pear*">("pea"));
+static_assert(static_matches<"ca{3}t">("caaat"));
+static_assert(!static_matches<"ca{3}t">("caat"));
+static_assert(!static_matches<"ca{3}t">("caaaat"));
+static_assert(static_matches<"d\\d{2}g">("d42g"));
+static_assert(!static_matches<"d\\d{2}g">("d1g"));
+static_assert(!static_matches<"d\\d{2}g">("d123g"));
+static_assert(static_matches<"c[xyz]{4}w">("czyxzw"));
+static_assert(!static_matches<"c[xyz]{4}w">("cxyzw"));
+static_assert(static_matches<"a\\.b">("a.b"));
+static_assert(!static_matches<"a\\.b">("axb"));
+
+} // namespace
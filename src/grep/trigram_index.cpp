@@ -0,0 +1,409 @@
+#include "grep/trigram_index.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <queue>
+#include <tuple>
+
+#include <unistd.h>
+
+#include "grep/pattern.hpp"
+#include "grep/prefilter.hpp"
+
+namespace {
+
+constexpr char index_magic[8] = {'g', 'r', 'e', 'p', 'i', 'd', 'x', '1'};
+
+// followed by the files, the paths (padded to 8 bytes), the trigrams and
+// the postings, in the byte order of the machine that wrote it
+struct index_header_t {
+  char magic[8];
+  uint64_t file_count;
+  uint64_t paths_size;
+  uint64_t trigram_count;
+  uint64_t posting_count;
+};
+
+void add_trigrams(const std::string_view text, std::vector<uint32_t>& out) {
+  for (std::size_t i = 2; i < text.size(); i++) {
+    out.push_back(
+      static_cast<uint32_t>(static_cast<unsigned char>(text[i - 2])) << 16
+      | static_cast<uint32_t>(static_cast<unsigned char>(text[i - 1])) << 8
+      | static_cast<unsigned char>(text[i]));
+  }
+}
+
+// adds the trigrams of a literal run to query. Ignoring case, a trigram with
+// letters in it is a subquery with a branch for each way of casing them
+void add_run(
+  trigram_query_t& query, const std::string_view run, const bool ignore_case) {
+  if (!ignore_case) {
+    add_trigrams(run, query.trigrams);
+    return;
+  }
+  std::vector<uint32_t> trigrams;
+  add_trigrams(run, trigrams);
+  for (const uint32_t trigram : trigrams) {
+    std::vector<uint32_t> cased{0};
+    for (int shift = 16; shift >= 0; shift -= 8) {
+      const auto c = static_cast<char>(trigram >> shift);
+      std::vector<uint32_t> extended;
+      for (const uint32_t prefix : cased) {
+        extended.push_back(prefix << 8 | static_cast<uint8_t>(ascii_lower(c)));
+        if (is_ascii_letter(c)) {
+          extended.push_back(
+            prefix << 8 | static_cast<uint8_t>(ascii_lower(c) - 'a' + 'A'));
+        }
+      }
+      cased = std::move(extended);
+    }
+    if (cased.size() == 1) {
+      query.trigrams.push_back(cased.front());
+      continue;
+    }
+    std::vector<trigram_query_t> branches;
+    for (const uint32_t variant : cased) {
+      branches.push_back({.trigrams = {variant}, .subqueries = {}});
+    }
+    query.subqueries.push_back(std::move(branches));
+  }
+}
+
+// adds the constraints of other, which must hold as well
+void add_query(trigram_query_t& query, trigram_query_t other) {
+  query.trigrams.insert(
+    query.trigrams.end(), other.trigrams.begin(), other.trigrams.end());
+  query.subqueries.insert(
+    query.subqueries.end(), std::make_move_iterator(other.subqueries.begin()),
+    std::make_move_iterator(other.subqueries.end()));
+}
+
+trigram_query_t plan_alternatives(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  bool ignore_case);
+
+// the same literal runs and capture groups the prefilter requires, so the
+// files picked are those the scanner could match in
+trigram_query_t plan_branch(
+  const std::vector<pattern_token_t>& pattern_tokens, const bool ignore_case) {
+  trigram_query_t query;
+  for (const auto& part : required_parts(pattern_tokens)) {
+    if (part.capture) {
+      add_query(query, plan_alternatives(*part.capture, ignore_case));
+    } else {
+      add_run(query, part.run, ignore_case);
+    }
+  }
+  return query;
+}
+
+trigram_query_t plan_alternatives(
+  const std::vector<std::vector<pattern_token_t>>& alternatives,
+  const bool ignore_case) {
+  std::vector<trigram_query_t> branches;
+  for (const auto& pattern_tokens : alternatives) {
+    branches.push_back(plan_branch(pattern_tokens, ignore_case));
+    if (branches.back().matches_everything()) {
+      return {};
+    }
+  }
+  if (branches.size() == 1) {
+    return std::move(branches.front());
+  }
+  trigram_query_t query;
+  if (!branches.empty()) {
+    query.subqueries.push_back(std::move(branches));
+  }
+  return query;
+}
+
+void normalize(trigram_query_t& query) {
+  std::ranges::sort(query.trigrams);
+  query.trigrams.erase(
+    std::ranges::unique(query.trigrams).begin(), query.trigrams.end());
+  for (auto& branches : query.subqueries) {
+    for (auto& branch : branches) {
+      normalize(branch);
+    }
+  }
+}
+
+void intersect(
+  std::optional<std::vector<uint32_t>>& result,
+  const std::span<const uint32_t> files) {
+  if (!result) {
+    result.emplace(files.begin(), files.end());
+    return;
+  }
+  std::vector<uint32_t> both;
+  std::ranges::set_intersection(*result, files, std::back_inserter(both));
+  *result = std::move(both);
+}
+
+// nullopt if the query does not narrow the files down
+std::optional<std::vector<uint32_t>> evaluate(
+  const trigram_index_view_t& index, const trigram_query_t& query) {
+  std::optional<std::vector<uint32_t>> result;
+  for (const auto trigram : query.trigrams) {
+    intersect(result, index.files_containing(trigram));
+    if (result->empty()) {
+      return result;
+    }
+  }
+  for (const auto& branches : query.subqueries) {
+    std::vector<uint32_t> any;
+    bool narrowed = true;
+    for (const auto& branch : branches) {
+      const auto files = evaluate(index, branch);
+      if (!files) {
+        narrowed = false;
+        break;
+      }
+      std::vector<uint32_t> merged;
+      std::ranges::set_union(any, *files, std::back_inserter(merged));
+      any = std::move(merged);
+    }
+    if (narrowed) {
+      intersect(result, any);
+    }
+  }
+  return result;
+}
+
+} // namespace
+
+std::string_view trigram_index_view_t::path(const uint32_t file) const {
+  return paths.substr(files[file].path_offset, files[file].path_size);
+}
+
+std::span<const uint32_t> trigram_index_view_t::files_containing(
+  const uint32_t trigram) const {
+  const auto found = std::ranges::lower_bound(
+    trigrams, trigram, {}, &index_trigram_entry_t::trigram);
+  if (found == trigrams.end() || found->trigram != trigram) {
+    return {};
+  }
+  return postings.subspan(found->posting_offset, found->posting_count);
+}
+
+std::optional<trigram_index_view_t> read_trigram_index(
+  const std::string_view data) {
+  index_header_t header;
+  if (data.size() < sizeof(header)) {
+    return std::nullopt;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (std::memcmp(header.magic, index_magic, sizeof(index_magic)) != 0) {
+    return std::nullopt;
+  }
+  // guards the size computation below against overflowing
+  constexpr uint64_t limit = uint64_t(1) << 40;
+  if (
+    header.file_count > limit || header.paths_size > limit
+    || header.trigram_count > limit || header.posting_count > limit) {
+    return std::nullopt;
+  }
+  const uint64_t files_at = sizeof(header);
+  const uint64_t paths_at =
+    files_at + header.file_count * sizeof(index_file_entry_t);
+  const uint64_t trigrams_at = paths_at + header.paths_size;
+  const uint64_t postings_at =
+    trigrams_at + header.trigram_count * sizeof(index_trigram_entry_t);
+  const uint64_t end = postings_at + header.posting_count * sizeof(uint32_t);
+  if (end != data.size() || header.paths_size % 8 != 0) {
+    return std::nullopt;
+  }
+  // the data is mapped, so page aligned, and the sections are 8 byte aligned
+  trigram_index_view_t index{
+    .files = {
+      reinterpret_cast<const index_file_entry_t*>(data.data() + files_at),
+      header.file_count},
+    .paths = data.substr(paths_at, header.paths_size),
+    .trigrams = {
+      reinterpret_cast<const index_trigram_entry_t*>(data.data() + trigrams_at),
+      header.trigram_count},
+    .postings = {
+      reinterpret_cast<const uint32_t*>(data.data() + postings_at),
+      header.posting_count}};
+  for (const auto& file : index.files) {
+    if (file.path_offset + file.path_size > header.paths_size) {
+      return std::nullopt;
+    }
+  }
+  for (const auto& trigram : index.trigrams) {
+    if (
+      trigram.posting_offset + trigram.posting_count > header.posting_count) {
+      return std::nullopt;
+    }
+  }
+  return index;
+}
+
+std::vector<std::vector<uint32_t>> file_trigrams(
+  const trigram_index_view_t& index, const std::vector<int64_t>& new_numbers,
+  const std::size_t new_count) {
+  std::vector<std::vector<uint32_t>> trigrams(new_count);
+  // trigrams are visited in order, so every list comes out sorted
+  for (const auto& entry : index.trigrams) {
+    for (const auto file : index.postings.subspan(
+           entry.posting_offset, entry.posting_count)) {
+      if (file < new_numbers.size() && new_numbers[file] >= 0) {
+        trigrams[new_numbers[file]].push_back(entry.trigram);
+      }
+    }
+  }
+  return trigrams;
+}
+
+std::vector<uint32_t> extract_trigrams(const std::string_view contents) {
+  // one bit per trigram, cleared again before returning
+  thread_local std::vector<uint64_t> seen(std::size_t(1) << 18);
+  std::vector<uint32_t> trigrams;
+  uint32_t trigram = 0;
+  for (std::size_t i = 0; i < contents.size(); i++) {
+    trigram = (trigram << 8 | static_cast<unsigned char>(contents[i]))
+            & 0xffffff;
+    if (i < 2) {
+      continue;
+    }
+    auto& word = seen[trigram >> 6];
+    const auto bit = uint64_t(1) << (trigram & 63);
+    if ((word & bit) == 0) {
+      word |= bit;
+      trigrams.push_back(trigram);
+    }
+  }
+  for (const auto found : trigrams) {
+    seen[found >> 6] = 0;
+  }
+  std::ranges::sort(trigrams);
+  return trigrams;
+}
+
+bool write_trigram_index(
+  const std::string& filename, const std::vector<indexed_file_t>& files) {
+  index_header_t header{};
+  std::memcpy(header.magic, index_magic, sizeof(index_magic));
+  header.file_count = files.size();
+  std::vector<index_file_entry_t> file_entries;
+  std::string paths;
+  for (const auto& file : files) {
+    file_entries.push_back(
+      {.stamp = file.stamp,
+       .path_offset = paths.size(),
+       .path_size = static_cast<uint32_t>(file.path.size()),
+       .indexed = file.indexed ? 1u : 0u});
+    paths += file.path;
+  }
+  paths.resize((paths.size() + 7) / 8 * 8);
+  header.paths_size = paths.size();
+  // merges the sorted trigram lists of the files, taking the smallest
+  // trigram (and file number among equal ones) next
+  using cursor_t = std::tuple<uint32_t, uint32_t, std::size_t>;
+  std::priority_queue<cursor_t, std::vector<cursor_t>, std::greater<>> next;
+  for (uint32_t file = 0; file < files.size(); file++) {
+    if (!files[file].trigrams.empty()) {
+      next.emplace(files[file].trigrams.front(), file, 0);
+    }
+  }
+  std::vector<index_trigram_entry_t> trigram_entries;
+  std::vector<uint32_t> postings;
+  while (!next.empty()) {
+    const auto [trigram, file, position] = next.top();
+    next.pop();
+    if (trigram_entries.empty() || trigram_entries.back().trigram != trigram) {
+      trigram_entries.push_back(
+        {.trigram = trigram,
+         .posting_count = 0,
+         .posting_offset = postings.size()});
+    }
+    trigram_entries.back().posting_count++;
+    postings.push_back(file);
+    if (const auto& trigrams = files[file].trigrams;
+        position + 1 < trigrams.size()) {
+      next.emplace(trigrams[position + 1], file, position + 1);
+    }
+  }
+  header.trigram_count = trigram_entries.size();
+  header.posting_count = postings.size();
+  const auto temporary = filename + ".tmp" + std::to_string(getpid());
+  {
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    const auto write = [&out](const void* data, const std::size_t size) {
+      out.write(
+        static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    };
+    write(&header, sizeof(header));
+    write(
+      file_entries.data(), file_entries.size() * sizeof(index_file_entry_t));
+    write(paths.data(), paths.size());
+    write(
+      trigram_entries.data(),
+      trigram_entries.size() * sizeof(index_trigram_entry_t));
+    write(postings.data(), postings.size() * sizeof(uint32_t));
+    out.close();
+    if (!out) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+  }
+  if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool trigram_query_t::matches_everything() const {
+  return trigrams.empty() && subqueries.empty();
+}
+
+trigram_query_t plan_trigram_query(
+  const std::vector<std::string>& patterns, const bool fixed_strings,
+  const bool ignore_case) {
+  std::vector<trigram_query_t> branches;
+  for (const auto& pattern : patterns) {
+    if (fixed_strings) {
+      trigram_query_t query;
+      add_run(query, pattern, ignore_case);
+      branches.push_back(std::move(query));
+    } else {
+      branches.push_back(
+        plan_alternatives(parse_pattern(pattern), ignore_case));
+    }
+    if (branches.back().matches_everything()) {
+      return {};
+    }
+  }
+  trigram_query_t query;
+  if (branches.size() == 1) {
+    query = std::move(branches.front());
+  } else if (!branches.empty()) {
+    query.subqueries.push_back(std::move(branches));
+  }
+  normalize(query);
+  return query;
+}
+
+std::vector<uint32_t> candidate_files(
+  const trigram_index_view_t& index, const trigram_query_t& query) {
+  std::vector<uint32_t> all;
+  std::vector<uint32_t> not_indexed;
+  for (uint32_t file = 0; file < index.files.size(); file++) {
+    all.push_back(file);
+    if (!index.files[file].indexed) {
+      not_indexed.push_back(file);
+    }
+  }
+  auto narrowed = evaluate(index, query);
+  if (!narrowed) {
+    return all;
+  }
+  std::vector<uint32_t> candidates;
+  std::ranges::set_union(
+    *narrowed, not_indexed, std::back_inserter(candidates));
+  return candidates;
+}
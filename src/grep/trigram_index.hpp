@@ -0,0 +1,101 @@
+#pragma once
+
+// on-disk index of the three byte sequences (trigrams) in each file of a
+// searched tree, used to pick the files a pattern can match in without
+// reading the others. The index file is written by write_trigram_index and
+// read in place from a mapping with read_trigram_index
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// a file whose stamp changed since it was indexed is indexed again
+struct file_stamp_t {
+  uint64_t size = 0;
+  int64_t mtime_ns = 0;
+
+  bool operator==(const file_stamp_t&) const = default;
+};
+
+// a file as stored in the index file
+struct index_file_entry_t {
+  file_stamp_t stamp;
+  uint64_t path_offset;
+  uint32_t path_size;
+  // files without trigrams (binary or too large) are candidates for every
+  // pattern
+  uint32_t indexed;
+};
+
+struct index_trigram_entry_t {
+  uint32_t trigram;
+  uint32_t posting_count;
+  // into the postings, which list file numbers in increasing order
+  uint64_t posting_offset;
+};
+
+// the contents of an index file, valid while the buffer it was read from is
+struct trigram_index_view_t {
+  std::span<const index_file_entry_t> files;
+  std::string_view paths;
+  // by trigram
+  std::span<const index_trigram_entry_t> trigrams;
+  std::span<const uint32_t> postings;
+
+  std::string_view path(uint32_t file) const;
+  // sorted file numbers of the files containing trigram
+  std::span<const uint32_t> files_containing(uint32_t trigram) const;
+};
+
+// nullopt if data is not an index file (of this version)
+std::optional<trigram_index_view_t> read_trigram_index(std::string_view data);
+
+// a file to write to the index
+struct indexed_file_t {
+  std::string path;
+  file_stamp_t stamp;
+  bool indexed = true;
+  // sorted and unique
+  std::vector<uint32_t> trigrams;
+};
+
+// the trigrams of every file in the index whose number maps to one in
+// new_numbers (-1 for files being dropped), by new number
+std::vector<std::vector<uint32_t>> file_trigrams(
+  const trigram_index_view_t& index, const std::vector<int64_t>& new_numbers,
+  std::size_t new_count);
+
+// files larger than this are not indexed, as they contain most trigrams
+constexpr uint64_t max_indexed_file_size = 64 << 20;
+
+// sorted distinct trigrams of contents
+std::vector<uint32_t> extract_trigrams(std::string_view contents);
+
+// writes the files to a temporary file renamed to filename once complete,
+// so a reader never sees a partial index. Returns false if it failed
+bool write_trigram_index(
+  const std::string& filename, const std::vector<indexed_file_t>& files);
+
+// trigrams every line matching the patterns must contain: a line can match
+// if it contains all of trigrams and satisfies every subquery (at least one
+// branch of it). A query without trigrams or subqueries matches every line
+struct trigram_query_t {
+  std::vector<uint32_t> trigrams;
+  std::vector<std::vector<trigram_query_t>> subqueries;
+
+  bool matches_everything() const;
+};
+
+// planned from the required_parts of each branch of the patterns (as
+// compile_patterns would parse them), like the prefilter's literals
+trigram_query_t plan_trigram_query(
+  const std::vector<std::string>& patterns, bool fixed_strings,
+  bool ignore_case = false);
+
+// sorted numbers of the files in the index that can contain a match
+// (including every file that is not indexed)
+std::vector<uint32_t> candidate_files(
+  const trigram_index_view_t& index, const trigram_query_t& query);
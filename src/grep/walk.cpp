@@ -0,0 +1,412 @@
+#include "grep/walk.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <ranges>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+// position just past the class starting at glob[pos] (a '['), 0 if the
+// class is not terminated and '[' is an ordinary character
+std::size_t match_class(
+  const std::string_view glob, std::size_t pos, const char c, bool& matched) {
+  pos++;
+  const bool negated =
+    pos < glob.size() && (glob[pos] == '!' || glob[pos] == '^');
+  pos += negated ? 1 : 0;
+  matched = false;
+  // a ']' right after the opening bracket is a member
+  for (bool first = true; pos < glob.size(); first = false) {
+    if (glob[pos] == ']' && !first) {
+      matched = matched != negated;
+      return pos + 1;
+    }
+    char low = glob[pos];
+    if (low == '\\' && pos + 1 < glob.size()) {
+      low = glob[++pos];
+    }
+    char high = low;
+    if (
+      pos + 2 < glob.size() && glob[pos + 1] == '-' && glob[pos + 2] != ']') {
+      high = glob[pos + 2];
+      pos += 2;
+      if (high == '\\' && pos + 1 < glob.size()) {
+        high = glob[++pos];
+      }
+    }
+    matched = matched || (c >= low && c <= high);
+    pos++;
+  }
+  return 0;
+}
+
+// a gitignore rule, also used for the include and exclude globs
+struct ignore_rule_t {
+  std::string glob;
+  bool negated = false;
+  bool directory_only = false;
+  // contains a '/' so is matched against the path instead of the name
+  bool anchored = false;
+};
+
+std::optional<ignore_rule_t> parse_ignore_rule(std::string_view line) {
+  if (line.ends_with('\r')) {
+    line.remove_suffix(1);
+  }
+  // trailing spaces are dropped unless escaped
+  while (line.ends_with(' ') && !line.ends_with("\\ ")) {
+    line.remove_suffix(1);
+  }
+  if (line.empty() || line.starts_with('#')) {
+    return std::nullopt;
+  }
+  ignore_rule_t rule;
+  if (line.starts_with('!')) {
+    rule.negated = true;
+    line.remove_prefix(1);
+  }
+  if (line.ends_with('/')) {
+    rule.directory_only = true;
+    line.remove_suffix(1);
+  }
+  rule.anchored = line.find('/') != std::string_view::npos;
+  if (line.starts_with('/')) {
+    line.remove_prefix(1);
+  }
+  if (line.empty()) {
+    return std::nullopt;
+  }
+  rule.glob = line;
+  return rule;
+}
+
+bool rule_matches(
+  const ignore_rule_t& rule, const std::string_view path,
+  const bool is_directory) {
+  if (rule.directory_only && !is_directory) {
+    return false;
+  }
+  if (rule.anchored) {
+    return glob_matches(rule.glob, path);
+  }
+  const auto slash = path.rfind('/');
+  return glob_matches(
+    rule.glob,
+    slash == std::string_view::npos ? path : path.substr(slash + 1));
+}
+
+// the rules of the ignore files in one directory, which apply to paths
+// below it
+struct ignore_level_t {
+  std::vector<ignore_rule_t> rules;
+  // a path relative to the walk root becomes relative to this directory
+  // with the first strip characters replaced by prefix
+  std::string prefix;
+  std::size_t strip = 0;
+};
+
+void read_ignore_file(const std::string& filename, ignore_level_t& level) {
+  std::ifstream file(filename);
+  for (std::string line; std::getline(file, line);) {
+    if (auto rule = parse_ignore_rule(line)) {
+      level.rules.push_back(std::move(*rule));
+    }
+  }
+}
+
+std::string join_path(
+  const std::string& directory, const std::string_view name) {
+  std::string path = directory;
+  if (!path.empty() && !path.ends_with('/')) {
+    path.push_back('/');
+  }
+  return path.append(name);
+}
+
+struct walker_t {
+  const walk_options_t& options;
+  const std::function<bool(const std::string&)>& on_file;
+  walk_stats_t* stats;
+  // outermost first, deeper files take precedence
+  std::vector<ignore_level_t> ignore_levels;
+  std::vector<ignore_rule_t> include;
+  std::vector<ignore_rule_t> exclude;
+  std::vector<ignore_rule_t> exclude_dir;
+
+  bool is_ignored(const std::string_view relative, const bool is_directory) {
+    for (const auto& level : ignore_levels | std::views::reverse) {
+      const auto path =
+        level.prefix + std::string(relative.substr(level.strip));
+      for (const auto& rule : level.rules | std::views::reverse) {
+        if (rule_matches(rule, path, is_directory)) {
+          return !rule.negated;
+        }
+      }
+    }
+    return false;
+  }
+
+  bool any_matches(
+    const std::vector<ignore_rule_t>& rules, const std::string_view relative,
+    const bool is_directory) {
+    return std::ranges::any_of(rules, [&](const ignore_rule_t& rule) {
+      return rule_matches(rule, relative, is_directory);
+    });
+  }
+
+  bool skip(
+    const std::string_view name, const std::string_view relative,
+    const bool is_directory) {
+    if (name.starts_with('.') && !options.hidden) {
+      return true;
+    }
+    if (
+      !options.no_ignore && is_directory
+      && (name == ".git" || name == ".hg" || name == ".svn")) {
+      return true;
+    }
+    if (is_directory ? any_matches(exclude_dir, relative, true)
+                     : any_matches(exclude, relative, false)
+                         || (!include.empty()
+                             && !any_matches(include, relative, false))) {
+      return true;
+    }
+    return !options.no_ignore && is_ignored(relative, is_directory);
+  }
+
+  // relative is the path of directory below the root, empty for the root.
+  // Returns false if on_file stopped the walk
+  bool walk(const std::string& directory, const std::string& relative) {
+    struct entry_t {
+      std::string name;
+      unsigned char type;
+    };
+    std::vector<entry_t> entries;
+    bool has_ignore_file = false;
+    {
+      DIR* dir = opendir(directory.c_str());
+      if (dir == nullptr) {
+        return true;
+      }
+      if (stats != nullptr) {
+        stats->directories_read++;
+      }
+      while (const dirent* entry = readdir(dir)) {
+        const std::string_view name = entry->d_name;
+        if (name == "." || name == "..") {
+          continue;
+        }
+        has_ignore_file =
+          has_ignore_file || name == ".gitignore" || name == ".ignore";
+        entries.push_back({std::string(name), entry->d_type});
+      }
+      closedir(dir);
+    }
+    const bool pushed_level = has_ignore_file && !options.no_ignore;
+    if (pushed_level) {
+      ignore_level_t level{
+        .strip = relative.empty() ? 0 : relative.size() + 1};
+      // .ignore overrides .gitignore
+      read_ignore_file(join_path(directory, ".gitignore"), level);
+      read_ignore_file(join_path(directory, ".ignore"), level);
+      ignore_levels.push_back(std::move(level));
+    }
+    bool walking = true;
+    for (const auto& entry : entries) {
+      if (!walking) {
+        break;
+      }
+      const auto path = join_path(directory, entry.name);
+      auto type = entry.type;
+      if (type == DT_UNKNOWN || type == DT_LNK) {
+        // links are followed to files but not to directories
+        struct stat path_stat {};
+        if (stats != nullptr) {
+          stats->stat_calls++;
+        }
+        const bool link = type == DT_LNK;
+        const int result = link ? stat(path.c_str(), &path_stat)
+                                : lstat(path.c_str(), &path_stat);
+        if (result != 0) {
+          continue;
+        }
+        type = S_ISREG(path_stat.st_mode)            ? DT_REG
+             : S_ISDIR(path_stat.st_mode) && !link   ? DT_DIR
+                                                     : DT_UNKNOWN;
+      }
+      if (type != DT_REG && type != DT_DIR) {
+        continue;
+      }
+      const auto entry_relative = join_path(relative, entry.name);
+      if (skip(entry.name, entry_relative, type == DT_DIR)) {
+        if (stats != nullptr) {
+          stats->paths_skipped++;
+        }
+        continue;
+      }
+      walking = type == DT_DIR ? walk(path, entry_relative) : on_file(path);
+    }
+    if (pushed_level) {
+      ignore_levels.pop_back();
+    }
+    return walking;
+  }
+
+  // ignore files in the directories above root, up to the root of the git
+  // repository containing it (none if it is not in one)
+  void add_parent_levels(const std::string& root) {
+    char resolved[PATH_MAX];
+    if (realpath(root.c_str(), resolved) == nullptr) {
+      return;
+    }
+    std::string directory = resolved;
+    struct stat git_stat {};
+    if (stat(join_path(directory, ".git").c_str(), &git_stat) == 0) {
+      return;
+    }
+    // root relative to directory, as directory moves up
+    std::string below;
+    std::vector<ignore_level_t> levels;
+    for (;;) {
+      const auto slash = directory.rfind('/');
+      if (slash == std::string::npos || directory == "/") {
+        return;
+      }
+      below = below.empty()
+              ? directory.substr(slash + 1)
+              : directory.substr(slash + 1) + "/" + below;
+      directory = slash == 0 ? "/" : directory.substr(0, slash);
+      ignore_level_t level{.prefix = below + "/"};
+      read_ignore_file(join_path(directory, ".gitignore"), level);
+      read_ignore_file(join_path(directory, ".ignore"), level);
+      levels.push_back(std::move(level));
+      if (stat(join_path(directory, ".git").c_str(), &git_stat) == 0) {
+        break;
+      }
+    }
+    for (auto& level : levels | std::views::reverse) {
+      if (!level.rules.empty()) {
+        ignore_levels.push_back(std::move(level));
+      }
+    }
+  }
+};
+
+std::vector<ignore_rule_t> parse_globs(const std::vector<std::string>& globs) {
+  std::vector<ignore_rule_t> rules;
+  for (const auto& glob : globs) {
+    rules.push_back(
+      {.glob = glob, .anchored = glob.find('/') != std::string::npos});
+  }
+  return rules;
+}
+
+} // namespace
+
+bool glob_matches(const std::string_view glob, const std::string_view path) {
+  std::size_t g = 0;
+  std::size_t p = 0;
+  // where the last '*' was and the input it has consumed up to, to retry
+  // with one more character on a mismatch
+  std::size_t star = std::string_view::npos;
+  std::size_t star_end = 0;
+  while (p < path.size()) {
+    if (g < glob.size()) {
+      const bool component_start = g == 0 || glob[g - 1] == '/';
+      if (
+        glob.substr(g).starts_with("**") && component_start
+        && (g + 2 == glob.size() || glob[g + 2] == '/')) {
+        if (g + 2 == glob.size()) {
+          return true;
+        }
+        // "**/" matches nothing or any directories, try each
+        const auto rest = glob.substr(g + 3);
+        for (auto from = p;;) {
+          if (glob_matches(rest, path.substr(from))) {
+            return true;
+          }
+          from = path.find('/', from);
+          if (from == std::string_view::npos) {
+            return false;
+          }
+          from++;
+        }
+      }
+      const char c = glob[g];
+      if (c == '*') {
+        star = g++;
+        star_end = p;
+        continue;
+      }
+      if (c == '?' && path[p] != '/') {
+        g++;
+        p++;
+        continue;
+      }
+      if (c == '[') {
+        bool matched = false;
+        if (const auto end = match_class(glob, g, path[p], matched); end != 0) {
+          if (matched && path[p] != '/') {
+            g = end;
+            p++;
+            continue;
+          }
+        } else if (path[p] == '[') {
+          g++;
+          p++;
+          continue;
+        }
+      } else if (c == '\\' && g + 1 < glob.size()) {
+        if (glob[g + 1] == path[p]) {
+          g += 2;
+          p++;
+          continue;
+        }
+      } else if (c == path[p]) {
+        g++;
+        p++;
+        continue;
+      }
+    }
+    if (star != std::string_view::npos && path[star_end] != '/') {
+      p = ++star_end;
+      g = star + 1;
+      continue;
+    }
+    return false;
+  }
+  while (g < glob.size() && glob[g] == '*') {
+    g++;
+  }
+  return g == glob.size();
+}
+
+void walk_files(
+  const std::string& root, const walk_options_t& options,
+  const std::function<bool(const std::string&)>& on_file,
+  walk_stats_t* stats) {
+  struct stat root_stat {};
+  if (stat(root.c_str(), &root_stat) != 0 || !S_ISDIR(root_stat.st_mode)) {
+    // opening it reports the problem
+    on_file(root);
+    return;
+  }
+  walker_t walker{
+    .options = options,
+    .on_file = on_file,
+    .stats = stats,
+    .ignore_levels = {},
+    .include = parse_globs(options.include),
+    .exclude = parse_globs(options.exclude),
+    .exclude_dir = parse_globs(options.exclude_dir)};
+  if (!options.no_ignore) {
+    walker.add_parent_levels(root);
+  }
+  walker.walk(root, "");
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// which files a recursive search visits
+struct walk_options_t {
+  // search files and directories whose names start with '.'
+  bool hidden = false;
+  // do not read .gitignore and .ignore files or skip VCS directories
+  bool no_ignore = false;
+  // globs matched against file names (or against the path below the
+  // root when they contain a '/'), with include empty every file qualifies
+  std::vector<std::string> include;
+  std::vector<std::string> exclude;
+  // globs matched against directory names in the same way
+  std::vector<std::string> exclude_dir;
+};
+
+struct walk_stats_t {
+  uint64_t directories_read = 0;
+  // entries whose type readdir did not report
+  uint64_t stat_calls = 0;
+  // files and directories left out by ignore files, hidden names or globs
+  uint64_t paths_skipped = 0;
+};
+
+// gitignore style glob: '*' and '?' do not match '/', a "**" component
+// matches any number of directories, [...] classes (negated with '!' or
+// '^') and '\' escapes
+bool glob_matches(std::string_view glob, std::string_view path);
+
+// calls on_file with every regular file under root (root itself if it is
+// not a directory) in readdir order. Symbolic links to files are followed,
+// links to directories are not. Directories that cannot be read are skipped.
+// The walk stops when on_file returns false
+void walk_files(
+  const std::string& root, const walk_options_t& options,
+  const std::function<bool(const std::string&)>& on_file,
+  walk_stats_t* stats = nullptr);
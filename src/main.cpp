@@ -1,657 +1,2014 @@
 #include <algorithm>
-#include <cassert>
-#include <filesystem>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
-#include <numeric>
+#include <mutex>
+#include <optional>
 #include <ranges>
-#include <span>
 #include <string>
+#include <thread>
 #include <unordered_map>
-#include <variant>
 #include <vector>
 
-bool is_literal(const char c) {
-  // todo - more regex meta characters to add
-  return c != '\\' && c != '[' && c != '(' && c != '|';
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "grep/decompress.hpp"
+#include "grep/matcher.hpp"
+#include "grep/read_queue.hpp"
+#include "grep/scan.hpp"
+#include "grep/trigram_index.hpp"
+#include "grep/walk.hpp"
+
+// file descriptor closed on destruction (stdin, named "-", is left open)
+struct input_file_t {
+  int fd = -1;
+  // errno of the failed open
+  int error = 0;
+
+  explicit input_file_t(const std::string& filename)
+    : fd(filename == "-" ? STDIN_FILENO : open(filename.c_str(), O_RDONLY)) {
+    if (fd < 0) {
+      error = errno;
+    }
+  }
+  input_file_t(const input_file_t&) = delete;
+  input_file_t& operator=(const input_file_t&) = delete;
+  ~input_file_t() {
+    if (fd >= 0 && fd != STDIN_FILENO) {
+      close(fd);
+    }
+  }
+};
+
+// read-only mapping of a whole file, unmapped on destruction
+struct mapped_file_t {
+  const char* data = nullptr;
+  std::size_t size = 0;
+
+  mapped_file_t(const char* data, const std::size_t size)
+    : data(data), size(size) {
+  }
+  mapped_file_t(const mapped_file_t&) = delete;
+  mapped_file_t& operator=(const mapped_file_t&) = delete;
+  ~mapped_file_t() {
+    munmap(const_cast<char*>(data), size);
+  }
+
+  std::string_view contents() const {
+    return {data, size};
+  }
+};
+
+// nullptr if fd does not refer to a regular file that can be mapped
+std::unique_ptr<mapped_file_t> map_file(const int fd) {
+  struct stat file_stat {};
+  // some special files (e.g. in /proc) report a size of zero
+  if (
+    fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)
+    || file_stat.st_size == 0) {
+    return nullptr;
+  }
+  const auto size = static_cast<std::size_t>(file_stat.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  return std::make_unique<mapped_file_t>(static_cast<const char*>(data), size);
 }
 
-bool anchored_at_beginning(const char c) {
-  return c == '^';
+// file level counters for --stats, the match engine counts the rest
+struct file_stats_t {
+  std::atomic<uint64_t> files_opened = 0;
+  std::atomic<uint64_t> open_failures = 0;
+  std::atomic<uint64_t> binary_files_skipped = 0;
+  std::atomic<uint64_t> large_files_skipped = 0;
+  // searched decompressed, and those found to be corrupt part way
+  std::atomic<uint64_t> compressed_files = 0;
+  std::atomic<uint64_t> decompress_failures = 0;
+  // opening and mapping files, summed over threads
+  std::atomic<int64_t> open_ns = 0;
+};
+
+// a time to pass to record_open, only read when counting
+std::chrono::steady_clock::time_point open_started(const file_stats_t* stats) {
+  return stats != nullptr ? std::chrono::steady_clock::now()
+                          : std::chrono::steady_clock::time_point();
 }
 
-bool anchored_at_end(const std::string_view subpattern) {
-  assert(subpattern.size() == 2);
-  return subpattern[0] != '\\' && subpattern[1] == '$';
+void record_open(
+  file_stats_t* stats, const bool opened,
+  const std::chrono::steady_clock::time_point started) {
+  if (stats == nullptr) {
+    return;
+  }
+  (opened ? stats->files_opened : stats->open_failures)++;
+  stats->open_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - started)
+                      .count();
 }
 
-bool is_escape(const char c) {
-  return c == '\\';
+// checks made on a mapped file before scanning it (files that cannot be
+// mapped are scanned regardless, compressed files are checked as they are
+// decompressed)
+struct file_filter_t {
+  // files with a NUL byte in their first block are skipped
+  bool skip_binary = false;
+  // larger files are skipped, nullopt for no limit
+  std::optional<uint64_t> max_size;
+  // empty input is searched as one empty line, as stdin was when it was
+  // read as a single line
+  bool empty_is_line = false;
+};
+
+constexpr std::size_t binary_check_size = 32 << 10;
+
+// true (and counted) if the file should not be scanned
+bool filter_out(
+  const file_filter_t& filter, const std::string_view contents,
+  file_stats_t* stats) {
+  if (filter.max_size && contents.size() > *filter.max_size) {
+    if (stats != nullptr) {
+      stats->large_files_skipped++;
+    }
+    return true;
+  }
+  if (
+    filter.skip_binary
+    && std::memchr(
+         contents.data(), '\0', std::min(contents.size(), binary_check_size))
+         != nullptr) {
+    if (stats != nullptr) {
+      stats->binary_files_skipped++;
+    }
+    return true;
+  }
+  return false;
 }
 
-bool is_character_opener(const char c) {
-  return c == '[';
+// true if contents (the start of it at least) is in a format that is
+// searched decompressed
+bool is_compressed(const std::string_view contents) {
+  return can_decompress(detect_compression(contents));
 }
 
-bool is_capture_group_opener(const char c) {
-  return c == '(';
+// scans input that is not in memory as a whole: the bytes of contents
+// followed by those read from fd (if it is not -1). Compressed input is
+// decompressed on a thread of its own as it is scanned, and is filtered by
+// its compressed size (if contents is all of it) and decompressed start.
+// on_line also observes the blocks scanned, as for scan_stream, and is told
+// (fail) if the input turns out to be corrupt. Returns false if the input
+// was filtered out
+template<typename on_line_t>
+bool scan_unmapped(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  std::string_view contents, const int fd, const file_filter_t& filter,
+  file_stats_t* stats, on_line_t& on_line) {
+  char magic[compression_magic_size];
+  if (contents.empty() && fd >= 0) {
+    std::size_t filled = 0;
+    while (filled < sizeof(magic)) {
+      const auto bytes_read = read(fd, magic + filled, sizeof(magic) - filled);
+      if (bytes_read < 0 && errno == EINTR) {
+        continue;
+      }
+      if (bytes_read <= 0) {
+        break;
+      }
+      filled += bytes_read;
+    }
+    contents = {magic, filled};
+    if (filled == 0 && filter.empty_is_line) {
+      contents = "\n";
+    }
+  }
+  const auto stream =
+    make_decompress_stream(detect_compression(contents), contents, fd);
+  if (!stream) {
+    scan_blocks(
+      compiled, scratch,
+      [&contents, fd](char* data, const std::size_t size) -> ssize_t {
+        if (contents.empty()) {
+          return fd >= 0 ? read(fd, data, size) : 0;
+        }
+        const auto count = std::min(size, contents.size());
+        std::memcpy(data, contents.data(), count);
+        contents.remove_prefix(count);
+        return static_cast<ssize_t>(count);
+      },
+      on_line, &on_line);
+    return true;
+  }
+  if (
+    filter_out({.max_size = filter.max_size}, contents, stats)
+    || filter_out(
+      {.skip_binary = filter.skip_binary}, peek_decompressed(*stream),
+      stats)) {
+    return false;
+  }
+  if (stats != nullptr) {
+    stats->compressed_files++;
+  }
+  scan_blocks(
+    compiled, scratch,
+    [&stream](char* data, const std::size_t size) {
+      return read_decompressed(*stream, data, size);
+    },
+    on_line, &on_line);
+  if (decompress_failed(*stream)) {
+    if (stats != nullptr) {
+      stats->decompress_failures++;
+    }
+    on_line.fail("corrupt or truncated compressed data");
+  }
+  return true;
 }
 
-bool is_alternator(const char c) {
-  return c == '|';
+// memory maps regular files and falls back to reading blocks otherwise,
+// returns false if the file could not be opened (on_line is told, see
+// scan_unmapped) or was filtered out. on_line also observes the blocks
+// scanned, as for scan_stream (a mapped file is a single block)
+template<typename on_line_t>
+bool scan_file(
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  const std::string& filename, const file_filter_t& filter,
+  file_stats_t* stats, on_line_t& on_line) {
+  const auto started = open_started(stats);
+  const input_file_t file(filename);
+  const auto mapped = file.fd >= 0 ? map_file(file.fd) : nullptr;
+  record_open(stats, file.fd >= 0, started);
+  if (file.fd < 0) {
+    on_line.fail(std::strerror(file.error));
+    return false;
+  }
+  if (!mapped || is_compressed(mapped->contents())) {
+    return scan_unmapped(
+      compiled, scratch, mapped ? mapped->contents() : std::string_view(),
+      mapped ? -1 : file.fd, filter, stats, on_line);
+  }
+  if (filter_out(filter, mapped->contents(), stats)) {
+    return false;
+  }
+  on_line.begin_block(mapped->contents(), 0, 0);
+  scan_buffer(compiled, scratch, mapped->contents(), on_line);
+  on_line.end_block();
+  return true;
 }
 
-bool is_negating(const std::string_view subpattern) {
-  assert(subpattern.size() == 2);
-  return subpattern[0] == '[' && subpattern[1] == '^';
+// fixed set of worker threads each owning a task deque, workers take tasks
+// from the front of their own deque and steal from the back of the others
+struct work_stealing_pool_t {
+  using task_t = std::function<void(int worker)>;
+
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<task_t> tasks;
+  };
+
+  std::vector<std::unique_ptr<queue_t>> queues;
+  std::vector<std::jthread> threads;
+  // tasks sitting in a queue / submitted and not yet finished
+  std::atomic<int> queued = 0;
+  std::atomic<int> pending = 0;
+  std::atomic<unsigned> next_queue = 0;
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable task_available;
+  std::condition_variable all_done;
+
+  explicit work_stealing_pool_t(int thread_count);
+  ~work_stealing_pool_t();
+
+  // worker is the queue to push to, tasks submitted by a running task
+  // should pass their own worker index to keep work local
+  void submit(task_t task, std::optional<int> worker = std::nullopt);
+  // blocks until every submitted task has finished
+  void wait();
+
+  // runs one pending task on the calling worker, false if there was none
+  bool run_one(int worker);
+
+  std::optional<task_t> take(int worker);
+  void run(int worker);
+};
+
+work_stealing_pool_t::work_stealing_pool_t(const int thread_count) {
+  for (int i = 0; i < thread_count; i++) {
+    queues.push_back(std::make_unique<queue_t>());
+  }
+  for (int i = 0; i < thread_count; i++) {
+    threads.emplace_back([this, i] { run(i); });
+  }
 }
 
-bool is_digit_character_class(const char c) {
-  return c == 'd';
+work_stealing_pool_t::~work_stealing_pool_t() {
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  task_available.notify_all();
+  threads.clear();
 }
 
-bool is_word_character_class(const char c) {
-  return c == 'w';
+void work_stealing_pool_t::submit(task_t task, std::optional<int> worker) {
+  const auto index = worker.value_or(next_queue++ % queues.size());
+  pending++;
+  {
+    auto& queue = *queues[index];
+    std::lock_guard lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard lock(mutex);
+    queued++;
+  }
+  task_available.notify_one();
 }
 
-bool is_number(unsigned char c) {
-  return std::isdigit(c);
+void work_stealing_pool_t::wait() {
+  std::unique_lock lock(mutex);
+  all_done.wait(lock, [this] { return pending == 0; });
 }
 
-struct one_or_more_t {};
-struct zero_or_one_t {};
-struct zero_or_more_t {};
-struct n_times_t {
-  int n_times;
-};
+std::optional<work_stealing_pool_t::task_t> work_stealing_pool_t::take(
+  const int worker) {
+  {
+    auto& queue = *queues[worker];
+    std::lock_guard lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      auto task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      queued--;
+      return task;
+    }
+  }
+  for (std::size_t i = 1; i < queues.size(); i++) {
+    auto& queue = *queues[(worker + i) % queues.size()];
+    std::lock_guard lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      auto task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      queued--;
+      return task;
+    }
+  }
+  return std::nullopt;
+}
 
-// enum class quantifier_e { one_or_more, zero_or_one, zero_or_more };
-using quantifier_t =
-  std::variant<one_or_more_t, zero_or_one_t, zero_or_more_t, n_times_t>;
+bool work_stealing_pool_t::run_one(const int worker) {
+  auto task = take(worker);
+  if (!task) {
+    return false;
+  }
+  (*task)(worker);
+  if (--pending == 0) {
+    std::lock_guard lock(mutex);
+    all_done.notify_all();
+  }
+  return true;
+}
 
-struct literal_t {
-  std::optional<quantifier_t> quantifier;
-  char l;
-};
+void work_stealing_pool_t::run(const int worker) {
+  for (;;) {
+    if (run_one(worker)) {
+      continue;
+    }
+    std::unique_lock lock(mutex);
+    task_available.wait(lock, [this] { return stopping || queued > 0; });
+    if (stopping && queued == 0) {
+      return;
+    }
+  }
+}
 
-struct digit_t {
-  std::optional<quantifier_t> quantifier;
-};
+// collects output in a large buffer and writes it to fd in big blocks, or
+// after every write when line buffered (e.g. when fd is a terminal)
+struct output_writer_t {
+  static constexpr std::size_t buffer_size = 1 << 18;
+
+  int fd;
+  bool line_buffered;
+  std::unique_ptr<char[]> buffer = std::make_unique<char[]>(buffer_size);
+  std::size_t used = 0;
+
+  explicit output_writer_t(const int fd)
+    : fd(fd), line_buffered(isatty(fd) != 0) {
+  }
+  output_writer_t(const output_writer_t&) = delete;
+  output_writer_t& operator=(const output_writer_t&) = delete;
+  ~output_writer_t() {
+    flush();
+  }
 
-struct word_t {
-  std::optional<quantifier_t> quantifier;
+  void write(std::string_view text);
+  void flush();
 };
 
-struct positive_character_group_t {
-  std::string group;
-  std::optional<quantifier_t> quantifier;
+void write_all(const int fd, std::string_view text) {
+  while (!text.empty()) {
+    const auto written = ::write(fd, text.data(), text.size());
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      // nothing sensible to do if the reader went away
+      return;
+    }
+    text.remove_prefix(written);
+  }
+}
+
+void output_writer_t::write(const std::string_view text) {
+  if (used + text.size() > buffer_size) {
+    flush();
+  }
+  if (text.size() >= buffer_size) {
+    write_all(fd, text);
+  } else {
+    std::memcpy(buffer.get() + used, text.data(), text.size());
+    used += text.size();
+  }
+  if (line_buffered) {
+    flush();
+  }
+}
+
+void output_writer_t::flush() {
+  write_all(fd, std::string_view(buffer.get(), used));
+  used = 0;
+}
+
+// where a piece of output belongs, every file gets the next unit and a file
+// scanned in chunks has one part per chunk
+struct output_position_t {
+  uint64_t unit = 0;
+  uint64_t part = 0;
+
+  auto operator<=>(const output_position_t&) const = default;
 };
 
-struct negative_character_group_t {
-  std::string group;
-  std::optional<quantifier_t> quantifier;
+// what is written for the matches: the lines, the number of matching lines
+// in each file (-c), the names of files with matches (-l) or nothing (-q,
+// which stops the search at the first match). Later modes take precedence
+enum class output_mode_e { lines, count, files_with_matches, quiet };
+
+// output of a part that cannot pause (see part_writer_t) moved out of
+// memory into a temporary file until the part becomes the head
+struct spill_t {
+  struct close_t {
+    void operator()(std::FILE* file) const {
+      std::fclose(file);
+    }
+  };
+
+  std::unique_ptr<std::FILE, close_t> file;
+  // the output in file, a failed write may leave more after it
+  std::size_t size = 0;
 };
 
-struct wildcard_t {
-  std::optional<quantifier_t> quantifier;
+// appends buffer to the spill (creating its file) and clears it, it is kept
+// in memory if the file cannot be written
+void spill_buffer(spill_t& spill, std::string& buffer) {
+  if (!spill.file) {
+    spill.file.reset(std::tmpfile());
+    if (!spill.file) {
+      return;
+    }
+  }
+  if (
+    std::fseek(spill.file.get(), static_cast<long>(spill.size), SEEK_SET) != 0
+    || std::fwrite(buffer.data(), 1, buffer.size(), spill.file.get())
+         != buffer.size()) {
+    return;
+  }
+  spill.size += buffer.size();
+  buffer.clear();
+}
+
+// a finished part's output waiting for the head to reach it
+struct held_part_t {
+  spill_t spill;
+  std::string buffer;
 };
 
-struct backreference_t {
-  int number;
-  std::optional<quantifier_t> quantifier;
+// writes output in the order files were submitted while they are scanned
+// in any order. Output of the head (the oldest unfinished part) is streamed
+// straight out and other parts are held back. At most window units are in
+// flight and a part that is not the head pauses once it holds buffer_limit
+// bytes (it is resumed when it becomes the head) or, if it cannot pause,
+// spills them to a temporary file, so memory use does not depend on how
+// much matches
+struct ordered_output_t {
+  output_writer_t& out;
+  // what a matching line is prefixed with, and -o writing each match in it
+  // on a line of its own
+  bool show_filenames = false;
+  bool line_numbers = false;
+  bool byte_offsets = false;
+  bool only_matching = false;
+  // lines written before and after each matching line (-B, -A). Once
+  // either is given (even as 0) groups of lines that are not adjacent are
+  // separated by "--"
+  bool context = false;
+  uint64_t before_context = 0;
+  uint64_t after_context = 0;
+  output_mode_e mode = output_mode_e::lines;
+  // matching lines after which a file is not scanned further (-m), files
+  // are then scanned as a single part so the first ones are found
+  std::optional<uint64_t> max_count;
+  uint64_t window = 64;
+  std::size_t buffer_limit = 256 << 10;
+
+  std::mutex mutex;
+  std::condition_variable head_moved;
+  output_position_t head;
+  uint64_t next_unit = 0;
+  // units split into more than one part
+  std::map<uint64_t, uint64_t> unit_parts;
+  // finished parts waiting for the head to reach them
+  std::map<output_position_t, held_part_t> completed;
+  // paused parts and how to resume them
+  std::map<output_position_t, std::function<void()>> paused;
+  // nothing is written before the first separator
+  bool written_any = false;
+  std::atomic<bool> matched = false;
+  // a file could not be searched in full (and was reported on stderr)
+  std::atomic<bool> failed = false;
+  // set once the search can end (-q matched), files not yet scanned are
+  // skipped and no more are submitted
+  std::atomic<bool> stopped = false;
 };
 
-struct begin_anchor_t {};
-struct end_anchor_t {};
+// blocks while the window is full
+uint64_t begin_unit(ordered_output_t& output) {
+  std::unique_lock lock(output.mutex);
+  output.head_moved.wait(lock, [&output] {
+    return output.next_unit < output.head.unit + output.window;
+  });
+  return output.next_unit++;
+}
+
+// nullopt instead of blocking when the window is full
+std::optional<uint64_t> try_begin_unit(ordered_output_t& output) {
+  std::lock_guard lock(output.mutex);
+  if (output.next_unit >= output.head.unit + output.window) {
+    return std::nullopt;
+  }
+  return output.next_unit++;
+}
+
+// must be called by part 0 of the unit before it finishes
+void split_unit(
+  ordered_output_t& output, const uint64_t unit, const uint64_t parts) {
+  std::lock_guard lock(output.mutex);
+  output.unit_parts[unit] = parts;
+}
+
+// every file's output starts with a separator, which is dropped for the
+// first output written. Called with the mutex held
+void write_part(ordered_output_t& output, std::string_view text) {
+  if (text.empty()) {
+    return;
+  }
+  if (!output.written_any && output.context && text.starts_with("--\n")) {
+    text.remove_prefix(3);
+  }
+  output.written_any = true;
+  output.out.write(text);
+}
+
+// writes out and closes what a part spilled, before the rest of its output.
+// Called with the mutex held
+void write_spill(ordered_output_t& output, spill_t& spill) {
+  if (!spill.file) {
+    return;
+  }
+  std::rewind(spill.file.get());
+  char block[64 << 10];
+  for (std::size_t left = spill.size; left > 0;) {
+    const auto read =
+      std::fread(block, 1, std::min(left, sizeof(block)), spill.file.get());
+    if (read == 0) {
+      break;
+    }
+    write_part(output, {block, read});
+    left -= read;
+  }
+  spill = {};
+}
+
+void advance_head(ordered_output_t& output) {
+  const auto parts = output.unit_parts.find(output.head.unit);
+  if (
+    parts != output.unit_parts.end() && output.head.part + 1 < parts->second) {
+    output.head.part++;
+    return;
+  }
+  if (parts != output.unit_parts.end()) {
+    output.unit_parts.erase(parts);
+  }
+  output.head = {.unit = output.head.unit + 1, .part = 0};
+}
+
+// writes spill and buffer out if position is the head, returns false
+// otherwise
+bool try_flush_part(
+  ordered_output_t& output, const output_position_t position, spill_t& spill,
+  std::string& buffer) {
+  std::lock_guard lock(output.mutex);
+  if (output.head != position) {
+    return false;
+  }
+  write_spill(output, spill);
+  write_part(output, buffer);
+  buffer.clear();
+  return true;
+}
 
-struct capture_group_t {
-  // type matches pattern_token_t
-  using internal_pattern_t = std::vector<std::vector<std::variant<
-    literal_t, digit_t, word_t, positive_character_group_t,
-    negative_character_group_t, begin_anchor_t, end_anchor_t, wildcard_t,
-    capture_group_t, backreference_t>>>;
+// records how to resume a paused part, returns false (without keeping
+// resume) if the part has become the head in the meantime
+bool pause_part(
+  ordered_output_t& output, const output_position_t position,
+  std::function<void()>& resume) {
+  std::lock_guard lock(output.mutex);
+  if (output.head == position) {
+    return false;
+  }
+  output.paused.emplace(position, std::move(resume));
+  return true;
+}
 
-  std::unique_ptr<internal_pattern_t> pattern;
-  std::string match;
-  std::optional<quantifier_t> quantifier;
+void finish_part(
+  ordered_output_t& output, const output_position_t position,
+  std::string buffer, spill_t spill = {}) {
+  std::function<void()> resume;
+  {
+    std::lock_guard lock(output.mutex);
+    if (output.head != position) {
+      output.completed.emplace(
+        position,
+        held_part_t{.spill = std::move(spill), .buffer = std::move(buffer)});
+      return;
+    }
+    write_spill(output, spill);
+    write_part(output, buffer);
+    advance_head(output);
+    for (auto next = output.completed.begin();
+         next != output.completed.end() && next->first == output.head;
+         next = output.completed.begin()) {
+      write_spill(output, next->second.spill);
+      write_part(output, next->second.buffer);
+      output.completed.erase(next);
+      advance_head(output);
+    }
+    if (auto paused = output.paused.find(output.head);
+        paused != output.paused.end()) {
+      resume = std::move(paused->second);
+      output.paused.erase(paused);
+    }
+  }
+  output.head_moved.notify_all();
+  if (resume) {
+    resume();
+  }
+}
+
+// matches in a file so far, shared by its parts
+struct file_matches_t {
+  std::atomic<uint64_t> count = 0;
+  // nothing more needs scanning (-l listed the file, or -m reached)
+  std::atomic<bool> done = false;
+  // counted down as parts finish, the last one writes the count for -c
+  std::atomic<std::size_t> parts_left = 1;
 };
 
-struct anchor_e {
-  enum { begin = 1 << 0, end = 1 << 1 };
+void append_number(std::string& buffer, const uint64_t number) {
+  char digits[20];
+  const auto end = std::to_chars(std::begin(digits), std::end(digits), number);
+  buffer.append(digits, end.ptr);
+}
+
+// how far through its input a part's output has got, kept while the part
+// is paused
+struct part_cursor_t {
+  // where lines are, newlines are only counted for -n
+  line_counter_t lines;
+  // end of the last line written (past its newline), as an offset into the
+  // input, and the lines after it still to be written as context
+  uint64_t written_to = 0;
+  uint64_t after_left = 0;
+  // the first group of lines in the part is always separated, the
+  // separator is dropped if nothing was written before it
+  bool written_any = false;
+  // starts of the lines written before a match, reused between matches
+  std::vector<std::size_t> before;
 };
 
-using pattern_token_t = std::variant<
-  literal_t, digit_t, word_t, positive_character_group_t,
-  negative_character_group_t, begin_anchor_t, end_anchor_t, wildcard_t,
-  capture_group_t, backreference_t>;
-
-void set_quantifier(pattern_token_t& token, const quantifier_t quantifier) {
-  if (auto* p = std::get_if<literal_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<digit_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<word_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<negative_character_group_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<positive_character_group_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<capture_group_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<wildcard_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (auto* p = std::get_if<backreference_t>(&token)) {
-    p->quantifier = quantifier;
-  } else if (std::holds_alternative<begin_anchor_t>(token)) {
-    // noop
-  } else if (std::holds_alternative<end_anchor_t>(token)) {
-    // noop
-  }
-}
-
-std::optional<quantifier_t> get_quantifier(const pattern_token_t& token) {
-  if (auto* p = std::get_if<literal_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<digit_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<word_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<negative_character_group_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<positive_character_group_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<capture_group_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<wildcard_t>(&token)) {
-    return p->quantifier;
-  } else if (auto* p = std::get_if<backreference_t>(&token)) {
-    return p->quantifier;
-  }
-  // begin_anchor_t or end_anchor_t
-  return std::nullopt;
+// for the lines of contents (a mapped file or file read into memory),
+// streams are given their blocks as they are read
+part_cursor_t make_cursor(
+  const ordered_output_t& output, const std::string_view contents) {
+  part_cursor_t cursor{.lines = {.count_lines = output.line_numbers}};
+  cursor.lines.begin_block(contents, 0);
+  return cursor;
 }
 
-std::vector<std::vector<pattern_token_t>> parse_pattern(
-  const std::string_view pattern) {
-  std::vector<std::vector<pattern_token_t>> all_pattern_tokens;
-  std::vector<pattern_token_t> pattern_tokens;
-  const bool anchored_beginning = anchored_at_beginning(pattern.front());
-  if (anchored_beginning) {
-    pattern_tokens.push_back(begin_anchor_t{});
-  }
-  const bool anchored_end =
-    pattern.size() >= 2 ? anchored_at_end(pattern.substr(pattern.size() - 2, 2))
-                        : false;
-  for (int p = anchored_beginning ? 1 : 0;
-       p < (anchored_end ? pattern.size() - 1 : pattern.size());) {
-    if (is_literal(pattern[p])) {
-      if (pattern[p] == '+') {
-        set_quantifier(pattern_tokens.back(), one_or_more_t{});
-        p++;
-      } else if (pattern[p] == '?') {
-        set_quantifier(pattern_tokens.back(), zero_or_one_t{});
-        p++;
-      } else if (pattern[p] == '*') {
-        set_quantifier(pattern_tokens.back(), zero_or_more_t{});
-        p++;
-      } else if (pattern[p] == '{') {
-        const auto opening = pattern.begin() + p + 1;
-        const auto closing = std::find(opening, pattern.end(), '}');
-        const auto length = closing - opening;
-        const auto times =
-          std::stoi(std::string(pattern.substr(p + 1, length)));
-        set_quantifier(pattern_tokens.back(), n_times_t{.n_times = times});
-        p += length + 2;
-      } else if (pattern[p] == '.') {
-        pattern_tokens.push_back(wildcard_t{});
-        p++;
-      } else {
-        pattern_tokens.push_back(literal_t{.l = pattern[p++]});
-      }
-    } else {
-      if (is_escape(pattern[p])) {
-        if (is_digit_character_class(pattern[p + 1])) {
-          pattern_tokens.push_back(digit_t{});
-          p += 2;
-        } else if (is_word_character_class(pattern[p + 1])) {
-          pattern_tokens.push_back(word_t{});
-          p += 2;
-        } else if (pattern[p + 1] == '\\') {
-          pattern_tokens.push_back(literal_t{.l = '\\'});
-          p += 2;
-        } else if (is_number(pattern[p + 1])) {
-          const auto number_start = pattern.begin() + p + 1;
-          const auto number_end =
-            std::find_if_not(number_start, pattern.end(), is_number);
-          const auto number =
-            std::stoi(std::string(std::string_view(number_start, number_end)));
-          pattern_tokens.push_back(backreference_t{.number = number});
-          p += 1 + std::distance(number_start, number_end);
+// how a file is named in the output, like grep stdin (named "-") is
+// "(standard input)"
+std::string_view display_name(const std::string& filename) {
+  return filename == "-" ? "(standard input)" : std::string_view(filename);
+}
+
+// like grep, a file that cannot be searched (in full) is reported and the
+// search goes on with the next one
+void report_error(
+  ordered_output_t& output, const std::string& filename,
+  const std::string_view reason) {
+  output.failed = true;
+  write_all(
+    STDERR_FILENO,
+    "grep: " + std::string(display_name(filename)) + ": "
+      + std::string(reason) + '\n');
+}
+
+// formats one part's matches for the ordered output, returns false to pause
+// the scan when the buffer is full and the part is not the head, or to stop
+// it when the rest of the file does not matter (stopped is then set)
+struct part_writer_t {
+  ordered_output_t& output;
+  output_position_t position;
+  const std::string& filename;
+  file_matches_t& file;
+  part_cursor_t& cursor;
+  // to find the matches in a line for -o
+  const compiled_pattern_t& compiled;
+  match_scratch_t& scratch;
+  // input that cannot be resumed (e.g. a pipe) is never paused, its output
+  // is spilled instead
+  bool can_pause = true;
+  std::string buffer;
+  spill_t spill;
+  bool stopped = false;
+
+  bool operator()(const std::string_view line) {
+    output.matched = true;
+    switch (output.mode) {
+      case output_mode_e::quiet:
+        output.stopped = true;
+        return stop();
+      case output_mode_e::files_with_matches:
+        if (!file.done.exchange(true)) {
+          buffer.append(display_name(filename)).push_back('\n');
         }
-      } else if (is_character_opener(pattern[p])) {
-        if (is_negating(pattern.substr(p, 2))) {
-          const auto offset = p + 2;
-          const auto end = pattern.find(']', offset);
-          const auto characters = pattern.substr(offset, end - offset);
-          pattern_tokens.push_back(
-            negative_character_group_t{.group = std::string(characters)});
-          p += characters.size() + 3;
-        } else {
-          const auto offset = p + 1;
-          const auto end = pattern.find(']', offset);
-          const auto characters = pattern.substr(offset, end - offset);
-          pattern_tokens.push_back(
-            positive_character_group_t{.group = std::string(characters)});
-          p += characters.size() + 2;
+        return stop();
+      case output_mode_e::count:
+        return ++file.count != output.max_count || stop();
+      case output_mode_e::lines:
+        break;
+    }
+    const auto& lines = cursor.lines;
+    if (output.context) {
+      begin_group(line);
+    }
+    if (!output.only_matching) {
+      append_prefix(line, 0, ':');
+      buffer.append(line).push_back('\n');
+    } else {
+      // like grep, empty matches are not written
+      for (std::size_t from = 0; from <= line.size();) {
+        const auto match = find_match(compiled, scratch, line, from);
+        if (!match) {
+          break;
         }
-      } else if (is_capture_group_opener(pattern[p])) {
-        const auto offset = p + 1;
-        capture_group_t capture_group;
-        std::string sub_pattern;
-        int nesting_depth = 0;
-        for (int i = offset, size = 0;; size++, i++) {
-          if (pattern[i] == '(') {
-            nesting_depth++;
-          } else if (pattern[i] == ')') {
-            if (nesting_depth == 0) {
-              sub_pattern = pattern.substr(offset, size);
-              capture_group.pattern =
-                std::make_unique<std::vector<std::vector<pattern_token_t>>>(
-                  parse_pattern(sub_pattern));
-              break;
-            } else {
-              nesting_depth--;
-            }
-          }
+        if (match->end == match->start) {
+          from = match->end + 1;
+          continue;
         }
-        p += sub_pattern.size() + 2;
-        pattern_tokens.push_back(std::move(capture_group));
-      } else if (is_alternator(pattern[p])) {
-        all_pattern_tokens.push_back(std::move(pattern_tokens));
-        pattern_tokens.clear();
-        p++;
+        append_prefix(line, match->start, ':');
+        buffer.append(line.substr(match->start, match->end - match->start))
+          .push_back('\n');
+        from = match->end;
       }
     }
+    cursor.written_to = lines.offset_of(line) + line.size() + 1;
+    cursor.after_left = output.after_context;
+    if (output.max_count && ++file.count == output.max_count) {
+      return stop();
+    }
+    if (buffer.size() < output.buffer_limit && !output.out.line_buffered) {
+      return true;
+    }
+    if (
+      try_flush_part(output, position, spill, buffer)
+      || buffer.size() < output.buffer_limit) {
+      return true;
+    }
+    if (can_pause) {
+      return false;
+    }
+    spill_buffer(spill, buffer);
+    return true;
   }
-  if (anchored_end) {
-    pattern_tokens.push_back(end_anchor_t{});
-  }
-  if (!pattern_tokens.empty()) {
-    all_pattern_tokens.push_back(std::move(pattern_tokens));
-  }
-  return all_pattern_tokens;
-}
-
-struct match_result_t {
-  int start;
-  int move;
-};
 
-template<typename T>
-bool holds_alternative(const std::optional<quantifier_t>& optional_quantifier) {
-  return optional_quantifier
-    .transform([](const auto& quantifier) {
-      return std::holds_alternative<T>(quantifier);
-    })
-    .value_or(false);
-}
-
-bool holds_ntimes_alternative(
-  const std::optional<quantifier_t>& optional_quantifier, const int repeats) {
-  return optional_quantifier
-    .and_then([](const auto& quantifier) {
-      auto* p = std::get_if<n_times_t>(&quantifier);
-      return p != nullptr ? std::make_optional<n_times_t>(*p)
-                          : std::optional<n_times_t>{};
-    })
-    .transform(
-      [repeats](const n_times_t& n_times) { return repeats < n_times.n_times; })
-    .value_or(false);
-}
-
-std::optional<int> match_here(
-  std::string_view input, int input_pos, std::span<pattern_token_t> pattern,
-  int pattern_pos, uint32_t anchors,
-  std::span<capture_group_t*> captured_groups, int repeated_matches = 1);
-
-std::optional<int> do_match(
-  std::span<pattern_token_t> pattern, const int pattern_pos,
-  std::string_view input, const int input_pos, const uint32_t anchors,
-  std::span<capture_group_t*> captured_groups) {
-  if (input_pos >= input.size()) {
-    return std::nullopt;
+  bool stop() {
+    stopped = true;
+    return false;
   }
-  const char c = input[input_pos];
-  const auto anchors_for_subpattern = [&pattern, pattern_pos, anchors]() {
-    if (pattern_pos == 0) {
-      return ((anchors & anchor_e::begin) != 0) ? anchor_e::begin : 0;
-    }
-    if (pattern_pos == pattern.size() - 1) {
-      return ((anchors & anchor_e::end) != 0) ? anchor_e::end : 0;
+
+  // offset is of what is written in line, for -b. separator is ':' after a
+  // matching line's prefix and '-' after a context line's
+  void append_prefix(
+    const std::string_view line, const std::size_t offset,
+    const char separator) {
+    if (output.show_filenames) {
+      buffer.append(display_name(filename)).push_back(separator);
     }
-    return 0;
-  };
-  auto& token = pattern[pattern_pos];
-  if (auto* literal = std::get_if<literal_t>(&token)) {
-    if (literal->l == c) {
-      return 1;
+    if (output.line_numbers) {
+      append_number(buffer, cursor.lines.line_number_of(line));
+      buffer.push_back(separator);
     }
-    return std::nullopt;
-  } else if (auto* digit = std::get_if<digit_t>(&token)) {
-    if (std::isdigit(static_cast<unsigned char>(c))) {
-      return 1;
+    if (output.byte_offsets) {
+      append_number(buffer, cursor.lines.offset_of(line) + offset);
+      buffer.push_back(separator);
     }
-    return std::nullopt;
-  } else if (auto* word = std::get_if<word_t>(&token)) {
-    if (std::isalnum(static_cast<unsigned char>(c)) || c == '_') {
-      return 1;
+  }
+
+  void append_context_line(const std::string_view line) {
+    // like grep, -o writes the separators but not the context
+    if (!output.only_matching) {
+      append_prefix(line, 0, '-');
+      buffer.append(line).push_back('\n');
     }
-    return std::nullopt;
-  } else if (auto* neg = std::get_if<negative_character_group_t>(&token)) {
-    if (neg->group.find(c) == std::string::npos) {
-      return 1;
+  }
+
+  // writes the lines after the last match that start before end (in the
+  // block) and are still wanted
+  void append_after_context(const std::size_t end) {
+    const auto& lines = cursor.lines;
+    while (cursor.after_left > 0 && cursor.written_to >= lines.block_offset
+           && cursor.written_to - lines.block_offset < end) {
+      const std::size_t start = cursor.written_to - lines.block_offset;
+      const auto newline = lines.block.find('\n', start);
+      const auto line_end =
+        newline == std::string_view::npos ? lines.block.size() : newline;
+      append_context_line(lines.block.substr(start, line_end - start));
+      cursor.written_to = lines.block_offset + line_end + 1;
+      cursor.after_left--;
     }
-    return std::nullopt;
-  } else if (auto* pos = std::get_if<positive_character_group_t>(&token)) {
-    if (pos->group.find(c) != std::string::npos) {
-      return 1;
+  }
+
+  // writes what comes before a matching line: the rest of the previous
+  // match's after context, a separator unless the lines are adjacent to
+  // those already written, and the lines before it. These are found by
+  // walking back from the match in the block, the scan having skipped them
+  void begin_group(const std::string_view line) {
+    const auto& lines = cursor.lines;
+    const std::size_t line_start = line.data() - lines.block.data();
+    append_after_context(line_start);
+    // lines already written are not written again
+    const std::size_t limit =
+      cursor.written_to > lines.block_offset
+        ? std::min<uint64_t>(cursor.written_to - lines.block_offset, line_start)
+        : 0;
+    cursor.before.clear();
+    for (std::size_t start = line_start;
+         cursor.before.size() < output.before_context && start > limit;) {
+      const char* newline =
+        find_last_newline(lines.block.data() + limit, start - 1 - limit);
+      start = newline != nullptr ? newline - lines.block.data() + 1 : limit;
+      cursor.before.push_back(start);
     }
-    return std::nullopt;
-  } else if (auto* capture = std::get_if<capture_group_t>(&token)) {
-    for (auto& pattern : *capture->pattern) {
-      if (
-        auto move = match_here(
-          input, input_pos, pattern, 0, anchors_for_subpattern(),
-          captured_groups)) {
-        capture->match = std::string(
-          input.begin() + input_pos, input.begin() + input_pos + *move);
-        return *move;
-      }
+    const auto first =
+      cursor.before.empty() ? line_start : cursor.before.back();
+    if (!cursor.written_any || lines.block_offset + first > cursor.written_to) {
+      buffer.append("--\n");
     }
-    return std::nullopt;
-  } else if (std::get_if<wildcard_t>(&token)) {
-    return 1;
-  } else if (auto* backreference = std::get_if<backreference_t>(&token)) {
-    int capture_group_index = backreference->number - 1;
-    if (capture_group_index < static_cast<int>(captured_groups.size())) {
-      auto match = parse_pattern(captured_groups[capture_group_index]->match);
-      for (auto& pattern : match) {
-        if (
-          auto move = match_here(
-            input, input_pos, pattern, 0, anchors_for_subpattern(),
-            captured_groups)) {
-          return *move;
-        }
-      }
+    cursor.written_any = true;
+    for (std::size_t i = cursor.before.size(); i-- > 0;) {
+      const auto start = cursor.before[i];
+      const auto end = (i > 0 ? cursor.before[i - 1] : line_start) - 1;
+      append_context_line(lines.block.substr(start, end - start));
     }
-    return std::nullopt;
   }
-  // begin_anchor_t or end_anchor_t
-  return std::nullopt;
+
+  // scan_stream and scan_file tell the writer about the blocks the lines
+  // are in, the after context at the end of one is written before it goes
+  void begin_block(
+    const std::string_view block, const uint64_t offset,
+    const std::size_t kept) {
+    cursor.lines.begin_block(block, offset, kept);
+  }
+
+  void end_block() {
+    append_after_context(cursor.lines.block.size());
+    cursor.lines.end_block();
+  }
+
+  // kept for the before context of a match at the start of the next block
+  std::size_t lines_to_keep() const {
+    return output.before_context;
+  }
+
+  // the lines scanned so far are still written
+  void fail(const std::string_view reason) {
+    report_error(output, filename, reason);
+  }
+};
+
+// true if a part of the file need not be scanned
+bool skip_part(const ordered_output_t& output, const file_matches_t& file) {
+  return output.stopped || file.done;
 }
 
-std::optional<int> match_here(
-  const std::string_view input, const int input_pos,
-  std::span<pattern_token_t> pattern, const int pattern_pos,
-  const uint32_t anchors, std::span<capture_group_t*> captured_groups,
-  const int repeated_matches) {
-  // base case
-  if (pattern_pos == pattern.size()) {
-    if ((anchors & anchor_e::end) != 0) {
-      return input_pos == input.size() ? std::make_optional(0) : std::nullopt;
-    }
-    return 0;
+// adds what is written once every part of the file is scanned to buffer,
+// which must be the output of one of its parts
+void end_file_part(
+  const ordered_output_t& output, const std::string& filename,
+  file_matches_t& file, std::string& buffer) {
+  if (output.mode != output_mode_e::count || --file.parts_left > 0) {
+    return;
   }
-  // base case
-  const auto quantifier = get_quantifier(pattern[pattern_pos]);
-  if (input_pos == input.size()) {
-    return holds_alternative<zero_or_one_t>(quantifier)
-            || holds_alternative<zero_or_more_t>(quantifier)
-           ? std::make_optional(0)
-           : std::nullopt;
-  }
-  std::optional<int> next_opt;
-  auto move_opt =
-    do_match(pattern, pattern_pos, input, input_pos, anchors, captured_groups);
-  if (!move_opt) {
-    if (
-      !holds_alternative<zero_or_one_t>(quantifier)
-      && !holds_alternative<zero_or_more_t>(quantifier)) {
-      return std::nullopt;
+  if (output.show_filenames) {
+    buffer.append(display_name(filename)).push_back(':');
+  }
+  buffer.append(std::to_string(file.count)).push_back('\n');
+}
+
+void do_matches(
+  const std::string& filename, const file_filter_t& filter,
+  const compiled_pattern_t& compiled, match_scratch_t& scratch,
+  ordered_output_t& output, const uint64_t unit, file_stats_t* stats) {
+  // scanned in order on a single thread so always the head and never paused
+  file_matches_t file;
+  auto cursor = make_cursor(output, {});
+  part_writer_t writer{
+    .output = output,
+    .position = {.unit = unit},
+    .filename = filename,
+    .file = file,
+    .cursor = cursor,
+    .compiled = compiled,
+    .scratch = scratch};
+  if (scan_file(compiled, scratch, filename, filter, stats, writer)) {
+    end_file_part(output, filename, file, writer.buffer);
+  }
+  finish_part(output, writer.position, std::move(writer.buffer));
+}
+
+// mapped files larger than twice this are split into chunks of roughly this
+// size (ending on a line boundary) which are scanned concurrently
+constexpr std::size_t parallel_chunk_size = 16 << 20;
+
+// shared by the tasks scanning the parts (chunks) of one file in memory
+struct file_parts_t {
+  // keeps contents (mapped or read into a buffer) alive
+  std::shared_ptr<const void> owner;
+  std::string_view contents;
+  std::string filename;
+  uint64_t unit;
+  std::vector<std::pair<std::size_t, std::size_t>> chunks;
+  // chunks are submitted as earlier ones finish to bound memory use
+  std::size_t chunks_in_flight;
+  file_matches_t matches;
+};
+
+// scanning state of one part, kept while the part is paused
+struct part_state_t {
+  std::shared_ptr<file_parts_t> file_parts;
+  std::size_t chunk;
+  // where to continue from when resumed
+  std::size_t offset;
+  std::string buffer;
+  part_cursor_t cursor;
+};
+
+struct parallel_search_t {
+  work_stealing_pool_t& pool;
+  const compiled_pattern_t& compiled;
+  // indexed by worker
+  std::vector<match_scratch_t>& worker_scratch;
+  ordered_output_t& output;
+  // null unless counting
+  file_stats_t* stats;
+};
+
+void scan_part(
+  parallel_search_t& search, std::shared_ptr<part_state_t> state,
+  const int worker) {
+  auto& file_parts = *state->file_parts;
+  const auto end = file_parts.chunks[state->chunk].second;
+  const output_position_t position{
+    .unit = file_parts.unit, .part = state->chunk};
+  while (!skip_part(search.output, file_parts.matches)) {
+    part_writer_t writer{
+      .output = search.output,
+      .position = position,
+      .filename = file_parts.filename,
+      .file = file_parts.matches,
+      .cursor = state->cursor,
+      .compiled = search.compiled,
+      .scratch = search.worker_scratch[worker],
+      .buffer = std::move(state->buffer)};
+    state->offset += scan_buffer(
+      search.compiled, search.worker_scratch[worker],
+      file_parts.contents.substr(state->offset, end - state->offset),
+      writer);
+    if (state->offset == end || writer.stopped) {
+      writer.end_block();
+      state->buffer = std::move(writer.buffer);
+      break;
     }
-    // try next pattern position, ignoring the previous mismatch
-    next_opt = match_here(
-      input, input_pos, pattern, pattern_pos + 1, anchors, captured_groups);
-    if (!next_opt) {
-      return std::nullopt;
+    state->buffer = std::move(writer.buffer);
+    std::function<void()> resume = [&search, state] {
+      search.pool.submit([&search, state](const int worker) {
+        scan_part(search, state, worker);
+      });
+    };
+    if (pause_part(search.output, position, resume)) {
+      return;
     }
-    move_opt = next_opt;
   }
-  if (!move_opt && holds_alternative<zero_or_more_t>(quantifier)) {
-    next_opt = match_here(
-      input, input_pos + 1, pattern, pattern_pos, anchors, captured_groups);
-    if (!next_opt) {
-      return std::nullopt;
-    }
-    move_opt = next_opt;
+  end_file_part(
+    search.output, file_parts.filename, file_parts.matches, state->buffer);
+  finish_part(search.output, position, std::move(state->buffer));
+  if (const auto next = state->chunk + file_parts.chunks_in_flight;
+      next < file_parts.chunks.size()) {
+    auto next_state = std::make_shared<part_state_t>(part_state_t{
+      .file_parts = state->file_parts,
+      .chunk = next,
+      .offset = file_parts.chunks[next].first,
+      .buffer = {},
+      .cursor = make_cursor(search.output, file_parts.contents)});
+    search.pool.submit(
+      [&search, next_state](const int worker) {
+        scan_part(search, next_state, worker);
+      },
+      worker);
   }
+}
+
+// scans contents in chunks when it is large, owner keeps it alive
+void scan_contents(
+  parallel_search_t& search, std::shared_ptr<const void> owner,
+  const std::string_view contents, const std::string& filename,
+  const uint64_t unit, const int worker) {
+  auto file_parts = std::make_shared<file_parts_t>();
+  file_parts->owner = std::move(owner);
+  file_parts->contents = contents;
+  file_parts->filename = filename;
+  file_parts->unit = unit;
+  file_parts->chunks_in_flight = 2 * search.pool.queues.size();
+  // line numbers are counted in the one pass over the file, which chunks
+  // would need the newlines before them for, and context around matches
+  // would need separating across chunks
   if (
-    const auto n_times_matches =
-      holds_ntimes_alternative(quantifier, repeated_matches);
-    !next_opt
-    && (holds_alternative<one_or_more_t>(quantifier) || holds_alternative<zero_or_more_t>(quantifier) || n_times_matches)) {
-    // match again at next input position with current pattern position
-    next_opt = match_here(
-      input, input_pos + *move_opt, pattern, pattern_pos, anchors,
-      captured_groups, repeated_matches + 1);
-    // handle over matching, if we've matched more than n times already
-    if (!next_opt && n_times_matches) {
-      const auto& n_times = std::get<n_times_t>(*quantifier);
-      if (repeated_matches < n_times.n_times) {
-        return std::nullopt;
-      }
+    contents.size() < 2 * parallel_chunk_size || search.output.max_count
+    || search.output.line_numbers || search.output.context) {
+    file_parts->chunks.push_back({0, contents.size()});
+  } else {
+    for (std::size_t begin = 0; begin < contents.size();) {
+      const auto split =
+        std::min(begin + parallel_chunk_size, contents.size());
+      auto end = contents.find('\n', split);
+      end = end == std::string_view::npos ? contents.size() : end + 1;
+      file_parts->chunks.push_back({begin, end});
+      begin = end;
     }
+    split_unit(search.output, unit, file_parts->chunks.size());
+    file_parts->matches.parts_left = file_parts->chunks.size();
   }
-
-  if (!next_opt) {
-    // normal case, move to the next pattern position and input position
-    next_opt = match_here(
-      input, input_pos + *move_opt, pattern, pattern_pos + 1, anchors,
-      captured_groups);
-    // if previous case was a greedy matcher that failed, 'give back' characters
-    // repeatedly until we find a match with the next character in the input
-    if (!next_opt) {
-      for (auto move = *move_opt - 1; move > 1; move--) {
-        // backtrack
-        next_opt = match_here(
-          input, input_pos + move, pattern, pattern_pos + 1, anchors,
-          captured_groups);
-        if (next_opt) {
-          break;
-        }
-      }
+  const auto in_flight =
+    std::min(file_parts->chunks_in_flight, file_parts->chunks.size());
+  for (std::size_t chunk = in_flight; chunk-- > 0;) {
+    auto state = std::make_shared<part_state_t>(part_state_t{
+      .file_parts = file_parts,
+      .chunk = chunk,
+      .offset = file_parts->chunks[chunk].first,
+      .buffer = {},
+      .cursor = make_cursor(search.output, contents)});
+    if (chunk == 0) {
+      scan_part(search, std::move(state), worker);
+    } else {
+      search.pool.submit(
+        [&search, state](const int worker) {
+          scan_part(search, state, worker);
+        },
+        worker);
     }
   }
-  if (!next_opt) {
+}
+
+// scans input that is not in memory as a whole (see scan_unmapped) as the
+// unit's only part, which cannot be paused (its output is spilled)
+void scan_unmapped_part(
+  parallel_search_t& search, const std::string& filename,
+  const file_filter_t& filter, const uint64_t unit, const int worker,
+  const std::string_view contents, const int fd) {
+  file_matches_t matches;
+  auto cursor = make_cursor(search.output, {});
+  part_writer_t writer{
+    .output = search.output,
+    .position = {.unit = unit},
+    .filename = filename,
+    .file = matches,
+    .cursor = cursor,
+    .compiled = search.compiled,
+    .scratch = search.worker_scratch[worker],
+    .can_pause = false};
+  if (scan_unmapped(
+        search.compiled, search.worker_scratch[worker], contents, fd, filter,
+        search.stats, writer)) {
+    end_file_part(search.output, filename, matches, writer.buffer);
+  }
+  finish_part(
+    search.output, writer.position, std::move(writer.buffer),
+    std::move(writer.spill));
+}
+
+void do_matches_parallel(
+  parallel_search_t& search, const std::string& filename,
+  const file_filter_t& filter, const uint64_t unit, const int worker) {
+  if (search.output.stopped) {
+    finish_part(search.output, {.unit = unit}, {});
+    return;
+  }
+  const auto started = open_started(search.stats);
+  const input_file_t file(filename);
+  std::shared_ptr<const mapped_file_t> mapped =
+    file.fd >= 0 ? map_file(file.fd) : nullptr;
+  record_open(search.stats, file.fd >= 0, started);
+  if (file.fd < 0) {
+    report_error(search.output, filename, std::strerror(file.error));
+    finish_part(search.output, {.unit = unit}, {});
+    return;
+  }
+  if (!mapped) {
+    scan_unmapped_part(search, filename, filter, unit, worker, {}, file.fd);
+    return;
+  }
+  const auto contents = mapped->contents();
+  if (is_compressed(contents)) {
+    scan_unmapped_part(search, filename, filter, unit, worker, contents, -1);
+    return;
+  }
+  if (filter_out(filter, contents, search.stats)) {
+    finish_part(search.output, {.unit = unit}, {});
+    return;
+  }
+  scan_contents(search, std::move(mapped), contents, filename, unit, worker);
+}
+
+// files read ahead of the workers at once with --io=io_uring or threads
+constexpr int read_depth = 32;
+
+// buffers the read queue filled, handed back once their file is scanned
+struct recycled_buffers_t {
+  // larger buffers are freed rather than kept
+  static constexpr std::size_t max_kept_size = 1 << 20;
+
+  std::mutex mutex;
+  std::vector<read_buffer_t> free;
+};
+
+read_buffer_t take_buffer(recycled_buffers_t& buffers) {
+  std::lock_guard lock(buffers.mutex);
+  if (buffers.free.empty()) {
+    return {};
+  }
+  auto buffer = std::move(buffers.free.back());
+  buffers.free.pop_back();
+  return buffer;
+}
+
+void recycle_buffer(recycled_buffers_t& buffers, read_buffer_t buffer) {
+  if (
+    buffer.capacity == 0
+    || buffer.capacity > recycled_buffers_t::max_kept_size) {
+    return;
+  }
+  std::lock_guard lock(buffers.mutex);
+  buffers.free.push_back(std::move(buffer));
+}
+
+// scans a file the read queue read, files it could not read (or that were
+// too large to) take the mapping path instead
+void scan_read_file(
+  parallel_search_t& search, recycled_buffers_t& buffers,
+  read_result_t result, const file_filter_t& filter, const int worker) {
+  const auto unit = result.tag;
+  if (search.output.stopped) {
+    recycle_buffer(buffers, std::move(result.buffer));
+    finish_part(search.output, {.unit = unit}, {});
+    return;
+  }
+  if (result.error != 0 || !result.complete) {
+    recycle_buffer(buffers, std::move(result.buffer));
+    do_matches_parallel(search, result.path, filter, unit, worker);
+    return;
+  }
+  if (search.stats != nullptr) {
+    search.stats->files_opened++;
+  }
+  const std::shared_ptr<read_buffer_t> owner(
+    new read_buffer_t(std::move(result.buffer)),
+    [&buffers](read_buffer_t* buffer) {
+      recycle_buffer(buffers, std::move(*buffer));
+      delete buffer;
+    });
+  const std::string_view contents(owner->data.get(), owner->size);
+  if (is_compressed(contents)) {
+    scan_unmapped_part(search, result.path, filter, unit, worker, contents, -1);
+    return;
+  }
+  if (filter_out(filter, contents, search.stats)) {
+    finish_part(search.output, {.unit = unit}, {});
+    return;
+  }
+  scan_contents(search, owner, contents, result.path, unit, worker);
+}
+
+enum class io_mode_e { mmap, io_uring, threads };
+
+enum class stats_format_e { none, text, json };
+
+struct options_t {
+  // a line matches if it matches any of them
+  std::vector<std::string> patterns;
+  bool fixed_strings = false;
+  // letters match in either case
+  bool ignore_case = false;
+  std::vector<std::string> paths;
+  // no paths were given so paths is stdin ("-")
+  bool implicit_stdin = false;
+  bool recursive = false;
+  walk_options_t walk;
+  // search files found by -r that look binary
+  bool text = false;
+  // larger files are skipped
+  std::optional<uint64_t> max_filesize;
+  // trigram index file narrowing down the files to scan
+  std::optional<std::string> index;
+  // counters and timings written to stderr after searching
+  stats_format_e stats = stats_format_e::none;
+  // per line, lines exceeding it are skipped and reported
+  uint64_t backtrack_budget = default_backtrack_budget;
+  int threads =
+    std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  // how files are read: ahead of the workers with io_uring (threads doing
+  // blocking reads where it is not available), or mapped by the workers
+  io_mode_e io = io_mode_e::io_uring;
+  output_mode_e output = output_mode_e::lines;
+  // matching lines after which a file is not scanned further
+  std::optional<uint64_t> max_count;
+  bool only_matching = false;
+  bool line_numbers = false;
+  bool byte_offsets = false;
+  // lines around each matching line, separators are written once either
+  // is given
+  std::optional<uint64_t> before_context;
+  std::optional<uint64_t> after_context;
+};
+
+// a line count
+std::optional<uint64_t> parse_count(const std::string_view count) {
+  uint64_t value = 0;
+  const auto parsed =
+    std::from_chars(count.data(), count.data() + count.size(), value);
+  if (
+    count.empty() || parsed.ec != std::errc()
+    || parsed.ptr != count.data() + count.size()) {
     return std::nullopt;
   }
-  return *next_opt + *move_opt;
+  return value;
 }
 
-std::optional<match_result_t> matcher(
-  std::string_view input, std::vector<std::vector<pattern_token_t>>& patterns,
-  std::span<capture_group_t*> captured_groups) {
-  if (input.empty()) {
-    return match_result_t{.start = 0, .move = 0};
+// a byte count with an optional K, M or G suffix
+std::optional<uint64_t> parse_size(std::string_view size) {
+  int shift = 0;
+  if (size.ends_with('K') || size.ends_with('M') || size.ends_with('G')) {
+    shift = size.back() == 'K' ? 10 : size.back() == 'M' ? 20 : 30;
+    size.remove_suffix(1);
   }
-  if (patterns.empty()) {
+  uint64_t value = 0;
+  const auto parsed =
+    std::from_chars(size.data(), size.data() + size.size(), value);
+  if (
+    size.empty() || parsed.ec != std::errc()
+    || parsed.ptr != size.data() + size.size()
+    || value > (std::numeric_limits<uint64_t>::max() >> shift)) {
     return std::nullopt;
   }
-  uint32_t anchors = 0;
-  auto& first_pattern = patterns.front();
-  if (first_pattern.empty()) {
+  return value << shift;
+}
+
+std::optional<options_t> parse_options(const int argc, char* argv[]) {
+  options_t options;
+  bool has_pattern = false;
+  // like grep, a pattern with newlines is a list of patterns (and an empty
+  // one, which split yields nothing for, matches every line)
+  const auto add_patterns = [&options](const std::string_view patterns) {
+    if (patterns.empty()) {
+      options.patterns.emplace_back();
+      return;
+    }
+    for (const auto pattern : std::views::split(patterns, '\n')) {
+      options.patterns.emplace_back(std::string_view(pattern));
+    }
+  };
+  for (int i = 1; i < argc; i++) {
+    const std::string_view arg = argv[i];
+    if (arg == "-r") {
+      options.recursive = true;
+    } else if (arg == "-F") {
+      options.fixed_strings = true;
+    } else if (arg == "-i" || arg == "--ignore-case") {
+      options.ignore_case = true;
+    } else if (arg == "-q" || arg == "-l" || arg == "-c") {
+      const auto mode = arg == "-q" ? output_mode_e::quiet
+                      : arg == "-l" ? output_mode_e::files_with_matches
+                                    : output_mode_e::count;
+      options.output = std::max(options.output, mode);
+    } else if (
+      arg.starts_with("-m") || arg.starts_with("-A") || arg.starts_with("-B")
+      || arg.starts_with("-C") || arg.starts_with("--max-count=")
+      || arg.starts_with("--after-context=")
+      || arg.starts_with("--before-context=")
+      || arg.starts_with("--context=")) {
+      const auto count = arg.starts_with("--") ? arg.substr(arg.find('=') + 1)
+                       : arg.size() > 2        ? arg.substr(2)
+                       : i + 1 < argc          ? std::string_view(argv[++i])
+                                               : std::string_view();
+      const auto value = parse_count(count);
+      const char flag = arg.starts_with("--max") ? 'm'
+                      : arg.starts_with("--a")   ? 'A'
+                      : arg.starts_with("--b")   ? 'B'
+                      : arg.starts_with("--c")   ? 'C'
+                                                 : arg[1];
+      if (!value) {
+        std::cerr << "Expected a line count after '-" << flag << "'"
+                  << std::endl;
+        return std::nullopt;
+      }
+      if (flag == 'm') {
+        options.max_count = value;
+      }
+      if (flag == 'A' || flag == 'C') {
+        options.after_context = *value;
+      }
+      if (flag == 'B' || flag == 'C') {
+        options.before_context = *value;
+      }
+    } else if (arg == "-o") {
+      options.only_matching = true;
+    } else if (arg == "-n") {
+      options.line_numbers = true;
+    } else if (arg == "-b") {
+      options.byte_offsets = true;
+    } else if (arg == "-a" || arg == "--text") {
+      options.text = true;
+    } else if (arg == "--hidden") {
+      options.walk.hidden = true;
+    } else if (arg == "--no-ignore") {
+      options.walk.no_ignore = true;
+    } else if (arg.starts_with("--include=")) {
+      options.walk.include.emplace_back(arg.substr(arg.find('=') + 1));
+    } else if (arg.starts_with("--exclude=")) {
+      options.walk.exclude.emplace_back(arg.substr(arg.find('=') + 1));
+    } else if (arg.starts_with("--exclude-dir=")) {
+      options.walk.exclude_dir.emplace_back(arg.substr(arg.find('=') + 1));
+    } else if (arg == "--io=mmap") {
+      options.io = io_mode_e::mmap;
+    } else if (arg == "--io=io_uring") {
+      options.io = io_mode_e::io_uring;
+    } else if (arg == "--io=threads") {
+      options.io = io_mode_e::threads;
+    } else if (arg.starts_with("--index=") && arg.size() > 8) {
+      options.index.emplace(arg.substr(arg.find('=') + 1));
+    } else if (arg.starts_with("--max-filesize=")) {
+      options.max_filesize = parse_size(arg.substr(arg.find('=') + 1));
+      if (!options.max_filesize) {
+        std::cerr << "Expected a size in '" << arg << "'" << std::endl;
+        return std::nullopt;
+      }
+    } else if (arg == "--stats" || arg == "--stats=text") {
+      options.stats = stats_format_e::text;
+    } else if (arg == "--stats=json") {
+      options.stats = stats_format_e::json;
+    } else if (arg.starts_with("--backtrack-budget=")) {
+      const auto budget = arg.substr(arg.find('=') + 1);
+      const auto parsed = std::from_chars(
+        budget.data(), budget.data() + budget.size(), options.backtrack_budget);
+      if (
+        budget.empty() || parsed.ec != std::errc()
+        || parsed.ptr != budget.data() + budget.size()) {
+        std::cerr << "Expected a step count in '" << arg << "'" << std::endl;
+        return std::nullopt;
+      }
+    } else if (arg == "-E" || arg == "-e") {
+      if (i + 1 == argc) {
+        std::cerr << "Expected a pattern after '" << arg << "'" << std::endl;
+        return std::nullopt;
+      }
+      add_patterns(argv[++i]);
+      has_pattern = true;
+    } else if (arg == "-f") {
+      if (i + 1 == argc) {
+        std::cerr << "Expected a pattern file after '-f'" << std::endl;
+        return std::nullopt;
+      }
+      std::ifstream file(argv[++i]);
+      if (!file) {
+        std::cerr << "Could not read patterns from '" << argv[i] << "'"
+                  << std::endl;
+        return std::nullopt;
+      }
+      for (std::string pattern; std::getline(file, pattern);) {
+        options.patterns.push_back(std::move(pattern));
+      }
+      has_pattern = true;
+    } else if (arg.starts_with("-j")) {
+      const auto threads = arg.size() > 2 ? arg.substr(2)
+                         : i + 1 < argc   ? std::string_view(argv[++i])
+                                          : std::string_view();
+      options.threads = std::atoi(std::string(threads).c_str());
+      if (options.threads < 1) {
+        std::cerr << "Expected a thread count after '-j'" << std::endl;
+        return std::nullopt;
+      }
+    } else if (arg == "--") {
+      // the rest are paths, even those starting with '-'
+      options.paths.insert(options.paths.end(), argv + i + 1, argv + argc);
+      break;
+    } else if (arg.starts_with('-') && arg != "-") {
+      std::cerr << "Unknown option '" << arg << "'" << std::endl;
+      return std::nullopt;
+    } else {
+      options.paths.emplace_back(arg);
+    }
+  }
+  if (!has_pattern) {
+    std::cerr << "Expected a pattern ('-E', '-e' or '-f')" << std::endl;
     return std::nullopt;
   }
-  if (std::holds_alternative<begin_anchor_t>(first_pattern.front())) {
-    anchors |= anchor_e::begin;
+  // like grep, without paths -r searches the working directory and
+  // otherwise stdin is searched (in blocks, as any stream)
+  if (options.paths.empty()) {
+    options.implicit_stdin = !options.recursive;
+    options.paths.emplace_back(options.recursive ? "." : "-");
   }
-  auto& last_pattern = patterns.back();
-  if (last_pattern.empty()) {
+  return options;
+}
+
+struct index_stats_t {
+  uint64_t files_indexed = 0;
+  uint64_t candidate_files = 0;
+  // ruled out by the index
+  uint64_t files_skipped = 0;
+};
+
+struct file_to_search_t {
+  std::string filename;
+  file_filter_t filter;
+};
+
+std::optional<file_stamp_t> stamp_file(const std::string& filename) {
+  struct stat file_stat {};
+  if (stat(filename.c_str(), &file_stat) != 0) {
     return std::nullopt;
   }
-  if (std::holds_alternative<end_anchor_t>(last_pattern.back())) {
-    anchors |= anchor_e::end;
+  return file_stamp_t{
+    .size = static_cast<uint64_t>(file_stat.st_size),
+    .mtime_ns = static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1'000'000'000
+              + file_stat.st_mtim.tv_nsec};
+}
+
+// binary and compressed files, and files that cannot be mapped, are left
+// unindexed, which makes them candidates for every pattern
+indexed_file_t index_file(
+  const std::string& filename, const file_stamp_t stamp) {
+  indexed_file_t file{.path = filename, .stamp = stamp};
+  const input_file_t input(filename);
+  const auto mapped = input.fd >= 0 ? map_file(input.fd) : nullptr;
+  if (!mapped) {
+    file.indexed = input.fd >= 0 && stamp.size == 0;
+    return file;
+  }
+  const auto contents = mapped->contents();
+  // compressed files are searched decompressed
+  file.indexed =
+    !is_compressed(contents) && contents.size() <= max_indexed_file_size
+    && std::memchr(
+         contents.data(), '\0', std::min(contents.size(), binary_check_size))
+         == nullptr;
+  if (file.indexed) {
+    file.trigrams = extract_trigrams(contents);
   }
-  for (int i = 0; i < input.size(); i++) {
-    for (auto& pattern : patterns) {
-      std::span<pattern_token_t> pattern_span = pattern;
-      if ((anchors & anchor_e::begin) != 0) {
-        pattern_span = pattern_span | std::views::drop(1);
+  return file;
+}
+
+// reads the index, updating it first if files were added or changed since
+// it was written (files it has that were not searched are kept while they
+// are unchanged), and returns the files the query can match in. Files are
+// returned unfiltered if the index cannot be written
+std::vector<file_to_search_t> filter_with_index(
+  const std::string& index_filename, const trigram_query_t& query,
+  std::vector<file_to_search_t> files, index_stats_t* stats) {
+  const auto load = [&index_filename] {
+    const input_file_t file(index_filename);
+    std::shared_ptr<const mapped_file_t> mapped =
+      file.fd >= 0 ? map_file(file.fd) : nullptr;
+    const auto index = mapped ? read_trigram_index(mapped->contents())
+                              : std::nullopt;
+    return std::pair{mapped, index};
+  };
+  auto [mapped, index] = load();
+  std::unordered_map<std::string_view, uint32_t> indexed_numbers;
+  for (uint32_t file = 0; index && file < index->files.size(); file++) {
+    indexed_numbers.emplace(index->path(file), file);
+  }
+  // by file, its number in the index, nullopt if it needs indexing
+  std::vector<std::optional<uint32_t>> numbers;
+  std::vector<std::optional<file_stamp_t>> stamps;
+  bool stale = !index;
+  for (const auto& file : files) {
+    stamps.push_back(stamp_file(file.filename));
+    const auto found = indexed_numbers.find(file.filename);
+    if (
+      stamps.back() && found != indexed_numbers.end()
+      && index->files[found->second].stamp == *stamps.back()) {
+      numbers.push_back(found->second);
+    } else {
+      numbers.emplace_back();
+      // files that cannot be stat'ed are searched but not indexed
+      stale = stale || stamps.back().has_value();
+    }
+  }
+  if (stale) {
+    std::vector<indexed_file_t> updated;
+    // from old numbers to updated ones, -1 for files not kept
+    std::vector<int64_t> kept(index ? index->files.size() : 0, -1);
+    std::unordered_map<std::string, uint32_t> updated_numbers;
+    const auto add = [&](indexed_file_t file) {
+      const auto [added, inserted] = updated_numbers.emplace(
+        file.path, static_cast<uint32_t>(updated.size()));
+      if (inserted) {
+        updated.push_back(std::move(file));
       }
-      if ((anchors & anchor_e::end) != 0) {
-        pattern_span = pattern_span | std::views::take(pattern_span.size() - 1);
+      return added->second;
+    };
+    for (std::size_t i = 0; i < files.size(); i++) {
+      if (numbers[i]) {
+        kept[*numbers[i]] = add(
+          {.path = files[i].filename,
+           .stamp = index->files[*numbers[i]].stamp,
+           .indexed = index->files[*numbers[i]].indexed != 0});
+      } else if (stamps[i]) {
+        add(index_file(files[i].filename, *stamps[i]));
+        if (stats != nullptr) {
+          stats->files_indexed++;
+        }
       }
+    }
+    for (uint32_t file = 0; index && file < index->files.size(); file++) {
+      const std::string path(index->path(file));
       if (
-        const auto result =
-          match_here(input, i, pattern_span, 0, anchors, captured_groups)) {
-        return match_result_t{.start = i, .move = *result};
-      } else if ((anchors & anchor_e::begin) != 0) {
-        goto end;
+        kept[file] < 0 && !updated_numbers.contains(path)
+        && stamp_file(path) == index->files[file].stamp) {
+        kept[file] = add(
+          {.path = path,
+           .stamp = index->files[file].stamp,
+           .indexed = index->files[file].indexed != 0});
+      }
+    }
+    if (index) {
+      auto trigrams = file_trigrams(*index, kept, updated.size());
+      for (std::size_t file = 0; file < kept.size(); file++) {
+        if (kept[file] >= 0) {
+          updated[kept[file]].trigrams = std::move(trigrams[kept[file]]);
+        }
       }
     }
+    if (!write_trigram_index(index_filename, updated)) {
+      std::cerr << "Could not write the index to '" << index_filename << "'"
+                << std::endl;
+      return files;
+    }
+    std::tie(mapped, index) = load();
+    if (!index) {
+      return files;
+    }
+    numbers.clear();
+    for (const auto& file : files) {
+      const auto found = updated_numbers.find(file.filename);
+      numbers.push_back(
+        found != updated_numbers.end()
+          ? std::optional<uint32_t>(found->second)
+          : std::nullopt);
+    }
   }
-end:
-  return std::nullopt;
+  const auto candidates = candidate_files(*index, query);
+  std::vector<file_to_search_t> selected;
+  for (std::size_t i = 0; i < files.size(); i++) {
+    if (!numbers[i] || std::ranges::binary_search(candidates, *numbers[i])) {
+      selected.push_back(std::move(files[i]));
+    }
+  }
+  if (stats != nullptr) {
+    stats->candidate_files += selected.size();
+    stats->files_skipped += files.size() - selected.size();
+  }
+  return selected;
 }
 
-std::vector<capture_group_t*> get_capture_groups(
-  std::vector<std::vector<pattern_token_t>>& parsed_pattern) {
-  return std::accumulate(
-    parsed_pattern.begin(), parsed_pattern.end(),
-    std::vector<capture_group_t*>{},
-    [](
-      std::vector<capture_group_t*> acc,
-      std::vector<pattern_token_t>& pattern_tokens) {
-      for (auto& pattern_token : pattern_tokens) {
-        if (
-          auto* capture_group = std::get_if<capture_group_t>(&pattern_token)) {
-          auto sub_capture_groups = get_capture_groups(*capture_group->pattern);
-          acc.push_back(capture_group);
-          acc.insert(
-            acc.end(), sub_capture_groups.begin(), sub_capture_groups.end());
-        }
+// what for_each_file needs besides the options, index_query is null
+// without --index and the stats are null unless counting
+struct file_source_t {
+  const trigram_query_t* index_query = nullptr;
+  walk_stats_t* walk_stats = nullptr;
+  index_stats_t* index_stats = nullptr;
+  // no more files are visited once set
+  const std::atomic<bool>* stopped = nullptr;
+};
+
+// calls on_file with every file to search, in traversal order, and the
+// checks to make on it (only files found by -r are checked for binary
+// content). With an index the files it rules out are left out, which needs
+// the whole list before the first call
+template<typename on_file_t>
+void for_each_file(
+  const options_t& options, const file_source_t& source,
+  on_file_t&& on_file) {
+  const file_filter_t named{
+    .max_size = options.max_filesize,
+    .empty_is_line = options.implicit_stdin};
+  const file_filter_t found{
+    .skip_binary = !options.text, .max_size = options.max_filesize};
+  const auto stopped = [&source] {
+    return source.stopped != nullptr && *source.stopped;
+  };
+  const auto visit = [&](auto&& on_path) {
+    for (const auto& path : options.paths) {
+      if (stopped()) {
+        return;
       }
-      return acc;
-    });
+      if (options.recursive) {
+        walk_files(
+          path, options.walk,
+          [&](const std::string& filename) {
+            on_path(filename, filename == path ? named : found);
+            return !stopped();
+          },
+          source.walk_stats);
+      } else {
+        on_path(path, named);
+      }
+    }
+  };
+  if (source.index_query == nullptr) {
+    visit(on_file);
+    return;
+  }
+  std::vector<file_to_search_t> files;
+  visit([&files](const std::string& filename, const file_filter_t& filter) {
+    files.push_back({.filename = filename, .filter = filter});
+  });
+  for (const auto& file : filter_with_index(
+         *options.index, *source.index_query, std::move(files),
+         source.index_stats)) {
+    if (stopped()) {
+      return;
+    }
+    on_file(file.filename, file.filter);
+  }
 }
 
-int grep(const std::string_view pattern, const std::string_view input) {
-  try {
-    auto parsed_pattern = parse_pattern(pattern);
-    auto capture_groups = get_capture_groups(parsed_pattern);
-    if (auto match = matcher(input, parsed_pattern, capture_groups)) {
-      // debug output matching part of string
-      // std::cerr << input.substr(match->start, match->move) << '\n';
-      return 0;
+// everything --stats reports
+struct stats_report_t {
+  walk_stats_t walk;
+  index_stats_t index;
+  file_stats_t files;
+  match_stats_t matching;
+  uint64_t dfa_states = 0;
+  uint64_t dfa_flushes = 0;
+  uint64_t lines_over_budget = 0;
+  std::chrono::nanoseconds compile_time{};
+  std::chrono::nanoseconds total_time{};
+};
+
+match_scratch_t make_scratch(
+  const options_t& options, const compiled_pattern_t& compiled,
+  const stats_report_t* report) {
+  auto scratch = make_match_scratch(compiled);
+  scratch.backtrack_budget = options.backtrack_budget;
+  if (report != nullptr) {
+    scratch.stats = std::make_unique<match_stats_t>();
+  }
+  return scratch;
+}
+
+void add_scratch_stats(stats_report_t& report, const match_scratch_t& scratch) {
+  report.matching += *scratch.stats;
+  report.dfa_states += scratch.search_dfa.state_sets.size();
+  report.dfa_flushes += scratch.search_dfa.flushes;
+}
+
+void print_stats(const stats_format_e format, const stats_report_t& report) {
+  const auto us = [](const std::chrono::nanoseconds time) {
+    return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(time).count());
+  };
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  const auto& matching = report.matching;
+  const std::pair<std::string_view, uint64_t> fields[]{
+    {"directories_read", report.walk.directories_read},
+    {"walk_stat_calls", report.walk.stat_calls},
+    {"paths_skipped", report.walk.paths_skipped},
+    {"index_files_indexed", report.index.files_indexed},
+    {"index_candidate_files", report.index.candidate_files},
+    {"index_files_skipped", report.index.files_skipped},
+    {"files_opened", report.files.files_opened},
+    {"open_failures", report.files.open_failures},
+    {"binary_files_skipped", report.files.binary_files_skipped},
+    {"large_files_skipped", report.files.large_files_skipped},
+    {"compressed_files", report.files.compressed_files},
+    {"decompress_failures", report.files.decompress_failures},
+    {"bytes_scanned", matching.bytes_scanned},
+    {"lines_scanned", matching.lines_scanned},
+    {"candidate_lines", matching.candidate_lines},
+    {"matched_lines", matching.matched_lines},
+    {"dfa_searches", matching.dfa_searches},
+    {"dfa_states", report.dfa_states},
+    {"dfa_cache_flushes", report.dfa_flushes},
+    {"backtrack_searches", matching.backtrack_searches},
+    {"backtrack_steps", matching.backtrack.steps},
+    {"backtrack_memo_hits", matching.backtrack.memo_hits},
+    {"backtrack_max_stack_depth", matching.backtrack.max_stack_depth},
+    {"backtrack_lines_over_budget", report.lines_over_budget},
+    // times spent by worker threads are summed over threads
+    {"compile_us", us(report.compile_time)},
+    {"open_us", us(std::chrono::nanoseconds(report.files.open_ns))},
+    {"read_us", us(matching.read_time)},
+    {"scan_us", us(matching.scan_time)},
+    {"total_us", us(report.total_time)},
+    {"peak_rss_kib", static_cast<uint64_t>(usage.ru_maxrss)},
+  };
+  std::string text = format == stats_format_e::json ? "{" : "";
+  for (const auto& [name, value] : fields) {
+    if (format == stats_format_e::json) {
+      if (text.size() > 1) {
+        text += ",";
+      }
+      text += "\"" + std::string(name) + "\":" + std::to_string(value);
     } else {
-      return 1;
+      text += std::string(name) + ": " + std::to_string(value) + "\n";
     }
-  } catch (const std::runtime_error& e) {
-    std::cerr << e.what() << std::endl;
-    return 1;
   }
+  if (format == stats_format_e::json) {
+    text += "}\n";
+  }
+  write_all(STDERR_FILENO, text);
 }
 
-using matches_t = std::vector<std::pair<std::string, std::vector<std::string>>>;
+bool is_regular_file(const std::string& filename) {
+  struct stat file_stat {};
+  return stat(filename.c_str(), &file_stat) == 0
+      && S_ISREG(file_stat.st_mode);
+}
 
-void do_matches(
-  const std::string& filename, const std::string_view pattern,
-  matches_t& matches) {
-  if (std::ifstream reader(filename); reader.is_open()) {
-    std::optional<std::string> matched_filename;
-    std::vector<std::string> matched_lines;
-    for (std::string line; std::getline(reader, line);) {
-      if (grep(pattern, line) == 0) {
-        if (!matched_filename) {
-          matched_filename = filename;
-        }
-        matched_lines.push_back(line);
+// reads the files on this thread through a read queue, many at a time, and
+// scans them on the pool as they arrive
+void read_and_search_files(
+  const options_t& options, const file_source_t& source,
+  parallel_search_t& search) {
+  recycled_buffers_t buffers;
+  std::mutex filters_mutex;
+  // by unit, for files being read
+  std::unordered_map<uint64_t, file_filter_t> filters;
+  const auto on_read = [&](read_result_t result) {
+    file_filter_t filter;
+    {
+      std::lock_guard lock(filters_mutex);
+      filter = filters.extract(result.tag).mapped();
+    }
+    // tasks are copyable, the buffer is not
+    search.pool.submit(
+      [&search, &buffers,
+       result = std::make_shared<read_result_t>(std::move(result)),
+       filter](const int worker) {
+        scan_read_file(search, buffers, std::move(*result), filter, worker);
+      });
+  };
+  auto queue = make_read_queue(
+    options.io == io_mode_e::io_uring ? read_backend_e::io_uring
+                                      : read_backend_e::threads,
+    read_depth, on_read);
+  if (!queue) {
+    queue = make_read_queue(read_backend_e::threads, read_depth, on_read);
+  }
+  for_each_file(
+    options, source,
+    [&](const std::string& filename, const file_filter_t& filter) {
+      // the oldest unit may be one only this thread can finish reading
+      // (with io_uring), so the reads are completed before waiting for it
+      auto unit = try_begin_unit(search.output);
+      if (!unit) {
+        drain_reads(*queue);
+        unit = begin_unit(search.output);
       }
+      // a named path may be a stream (such as /dev/stdin), whose data is
+      // gone if it is too large to read whole. Those are left to a worker
+      if (
+        std::ranges::find(options.paths, filename) != options.paths.end()
+        && !is_regular_file(filename)) {
+        search.pool.submit(
+          [&search, filename, filter, unit = *unit](const int worker) {
+            do_matches_parallel(search, filename, filter, unit, worker);
+          });
+        return;
+      }
+      {
+        std::lock_guard lock(filters_mutex);
+        filters.emplace(*unit, filter);
+      }
+      submit_read(
+        *queue,
+        {.path = filename, .tag = *unit, .buffer = take_buffer(buffers)});
+    });
+  drain_reads(*queue);
+  // the scans hand their buffers back
+  search.pool.wait();
+}
+
+struct search_result_t {
+  bool matched = false;
+  // a file could not be searched in full
+  bool failed = false;
+  // lines skipped as the backtracking engine gave up on them
+  uint64_t lines_over_budget = 0;
+};
+
+// report is filled in if not null
+search_result_t search_files(
+  const options_t& options, const compiled_pattern_t& compiled,
+  stats_report_t* report) {
+  output_writer_t writer(STDOUT_FILENO);
+  ordered_output_t output{
+    .out = writer,
+    .show_filenames = options.recursive || options.paths.size() > 1,
+    .line_numbers = options.line_numbers,
+    .byte_offsets = options.byte_offsets,
+    .only_matching = options.only_matching,
+    .context = options.before_context || options.after_context,
+    .before_context = options.before_context.value_or(0),
+    .after_context = options.after_context.value_or(0),
+    .mode = options.output,
+    .max_count = options.max_count,
+    .window = 4 * static_cast<uint64_t>(options.threads)
+            + (options.io != io_mode_e::mmap ? read_depth : 0)};
+  file_stats_t* file_stats = report != nullptr ? &report->files : nullptr;
+  // the index is only read when the patterns give it trigrams to look up
+  std::optional<trigram_query_t> index_query;
+  if (options.index) {
+    index_query = plan_trigram_query(
+      options.patterns, options.fixed_strings, options.ignore_case);
+    if (index_query->matches_everything()) {
+      index_query.reset();
+    }
+  }
+  const file_source_t source{
+    .index_query = index_query ? &*index_query : nullptr,
+    .walk_stats = report != nullptr ? &report->walk : nullptr,
+    .index_stats = report != nullptr ? &report->index : nullptr,
+    .stopped = &output.stopped};
+  if (options.threads == 1 && options.io == io_mode_e::mmap) {
+    auto scratch = make_scratch(options, compiled, report);
+    for_each_file(
+      options, source,
+      [&](const std::string& filename, const file_filter_t& filter) {
+        do_matches(
+          filename, filter, compiled, scratch, output, begin_unit(output),
+          file_stats);
+      });
+    if (report != nullptr) {
+      add_scratch_stats(*report, scratch);
+    }
+    return {
+      .matched = output.matched,
+      .failed = output.failed,
+      .lines_over_budget = scratch.lines_over_budget};
+  }
+  std::vector<match_scratch_t> worker_scratch;
+  for (int i = 0; i < options.threads; i++) {
+    worker_scratch.push_back(make_scratch(options, compiled, report));
+  }
+  {
+    work_stealing_pool_t pool(options.threads);
+    parallel_search_t search{
+      .pool = pool,
+      .compiled = compiled,
+      .worker_scratch = worker_scratch,
+      .output = output,
+      .stats = file_stats};
+    if (options.io != io_mode_e::mmap) {
+      read_and_search_files(options, source, search);
+    } else {
+      for_each_file(
+        options, source,
+        [&](const std::string& filename, const file_filter_t& filter) {
+          pool.submit([&search, filename, filter,
+                       unit = begin_unit(output)](const int worker) {
+            do_matches_parallel(search, filename, filter, unit, worker);
+          });
+        });
     }
-    if (matched_filename) {
-      matches.push_back(
-        {std::move(*matched_filename), std::move(matched_lines)});
+    pool.wait();
+  }
+  search_result_t result{
+    .matched = output.matched, .failed = output.failed};
+  for (const auto& scratch : worker_scratch) {
+    result.lines_over_budget += scratch.lines_over_budget;
+    if (report != nullptr) {
+      add_scratch_stats(*report, scratch);
     }
   }
+  return result;
 }
 
 int main(int argc, char* argv[]) {
-  // Flush after every std::cout / std::cerr
-  std::cout << std::unitbuf;
+  // Flush after every std::cerr (matches go through output_writer_t)
   std::cerr << std::unitbuf;
 
-  {
-    using std::literals::string_literals::operator""s;
-    auto match = grep("ca{3}t"s, "caat"s);
-    int a;
-    a = 0;
-  }
-
   if (argc < 3) {
     std::cerr << "Expected at least three arguments" << std::endl;
     return 1;
   }
 
-  const auto [flag, pattern, recursive] =
-    [&] -> std::tuple<std::string, std::string, bool> {
-    if (argv[1] == std::string("-r")) {
-      return std::tuple{argv[2], argv[3], true};
-    } else if (argv[1] == std::string("-E")) {
-      return std::tuple{argv[1], argv[2], false};
-    }
-    std::unreachable();
-  }();
+  // like grep, usage errors are reported with 2
+  const auto options = parse_options(argc, argv);
+  if (!options) {
+    return 2;
+  }
+  // like grep, nothing is read or written for -m 0
+  if (options->max_count == 0) {
+    return 1;
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  std::optional<stats_report_t> report;
+  if (options->stats != stats_format_e::none) {
+    report.emplace();
+  }
 
-  if (flag != "-E") {
-    std::cerr << "Expected first argument to be '-E'" << std::endl;
+  compiled_pattern_t compiled;
+  try {
+    compiled = compile_patterns(
+      options->patterns, options->fixed_strings, options->ignore_case);
+  } catch (const std::runtime_error& e) {
+    std::cerr << e.what() << std::endl;
     return 1;
   }
+  if (report) {
+    report->compile_time = std::chrono::steady_clock::now() - started;
+  }
 
-  if (argc >= 4) {
-    matches_t matches;
-    for (int i = recursive ? 4 : 3; i < argc; i++) {
-      if (recursive) {
-        namespace fs = std::filesystem;
-        const std::string& directory = argv[i];
-        for (const fs::directory_entry& entry :
-             fs::recursive_directory_iterator(directory)) {
-          if (fs::is_regular_file(entry.path())) {
-            do_matches(entry.path().string(), pattern, matches);
-          }
-        }
-      } else {
-        do_matches(argv[i], pattern, matches);
-      }
-    }
-    if (matches.empty()) {
-      return 1;
-    }
-    if (argc == 4) {
-      for (const auto& line : matches.front().second) {
-        std::cout << line << '\n';
-      }
-    } else if (argc >= 5) {
-      for (const auto& match : matches) {
-        for (const auto& line : match.second) {
-          std::cout << std::format("{}:{}", match.first, line) << '\n';
-        }
-      }
-    }
+  const auto result =
+    search_files(*options, compiled, report ? &*report : nullptr);
+  if (report) {
+    report->lines_over_budget = result.lines_over_budget;
+    report->total_time = std::chrono::steady_clock::now() - started;
+    print_stats(options->stats, *report);
+  }
+  if (result.lines_over_budget > 0) {
+    std::cerr << result.lines_over_budget
+              << " line(s) skipped, matching them exceeded the backtracking "
+                 "budget (see --backtrack-budget)"
+              << std::endl;
+  }
+  // like grep, a file that could not be searched is reported with 2 even if
+  // something matched, unless -q found a match
+  if (
+    result.failed
+    && !(result.matched && options->output == output_mode_e::quiet)) {
+    return 2;
+  }
+  // like grep, trouble is reported with 2 unless something matched
+  if (result.matched) {
     return 0;
-  } else {
-    std::string input;
-    std::getline(std::cin, input);
-    return grep(pattern, input);
   }
+  return result.lines_over_budget > 0 ? 2 : 1;
 }
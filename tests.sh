@@ -340,6 +340,16 @@ if [ $? -ne 0 ]; then
   echo "test failed - abc-def is abc-def, not efg, abc, or def"
 fi
 
+output=$(echo -n 'aa' | build/Debug/grep -E '(a)\5' 2>&1) # 1
+if [ $? -ne 1 ] || [ "$output" != 'Invalid backreference \5' ]; then
+  echo "test failed - (a)\\5"
+fi
+
+output=$(echo -n 'a' | build/Debug/grep -E '\0' 2>&1) # 1
+if [ $? -ne 1 ] || [ "$output" != 'Invalid backreference \0' ]; then
+  echo "test failed - \\0"
+fi
+
 echo -n 'ct' | build/Debug/grep -E 'ca*t' # 0
 if [ $? -ne 0 ]; then
   echo "test failed - ct"
@@ -434,3 +444,190 @@ echo -n 'cxyzw' | build/Debug/grep -E 'c[xyz]{4}w' # 1
 if [ $? -ne 1 ]; then
   echo "test failed - czyxzw"
 fi
+
+echo -n 'a.b' | build/Debug/grep -E 'a\.b' # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - a.b"
+fi
+
+echo -n 'axb' | build/Debug/grep -E 'a\.b' # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - axb"
+fi
+
+echo -n 'disk error' | build/Debug/grep -e 'timeout' -e 'error' # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - disk error"
+fi
+
+echo -n 'disk full' | build/Debug/grep -e 'timeout' -e 'error' # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - disk full"
+fi
+
+echo -n 'a+b' | build/Debug/grep -F -e 'a+b' -e 'c' # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - a+b"
+fi
+
+echo -n 'abc' | build/Debug/grep -f /dev/null # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - empty pattern file"
+fi
+
+output=$(printf 'a\n\nb\n' | build/Debug/grep -c -e '') # 0
+if [ $? -ne 0 ] || [ "$output" != "3" ]; then
+  echo "test failed - empty pattern"
+fi
+
+echo -n 'abcabc' | build/Debug/grep --stats=json -E '(abc)\1' 2>/dev/null # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - stats abcabc"
+fi
+
+echo -n 'aaaaaaaaaaaaaaaaaaaaaaaaaaaaaacb' | build/Debug/grep --backtrack-budget=10 -E '(a*)*\1b' 2>/dev/null # 2
+if [ $? -ne 2 ]; then
+  echo "test failed - backtrack budget"
+fi
+
+build/Debug/grep -r --include='*.hpp' -e 'walk_files' src > /dev/null # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - include walk_files"
+fi
+
+build/Debug/grep -r --exclude-dir=grep -e 'glob_matches' src > /dev/null # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - exclude-dir glob_matches"
+fi
+
+index=$(mktemp -u)
+build/Debug/grep -r --index="$index" -e 'filter_with_index' src > /dev/null
+build/Debug/grep -r --index="$index" -e 'filter_with_index' src > /dev/null # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - index filter_with_index"
+fi
+rm -f "$index"
+
+build/Debug/grep -r --io=threads -e 'read_and_search_files' src > /dev/null # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - io threads read_and_search_files"
+fi
+
+lines=$(mktemp)
+printf 'ab\nb\nab\nab\n' > "$lines"
+output=$(build/Debug/grep -q -e 'a' "$lines") # 0
+if [ $? -ne 0 ] || [ -n "$output" ]; then
+  echo "test failed - quiet a"
+fi
+
+output=$(build/Debug/grep -c -m 2 -e 'a' "$lines")
+if [ "$output" != "2" ]; then
+  echo "test failed - count max-count a"
+fi
+
+output=$(build/Debug/grep -l -e 'b' "$lines" "$lines")
+if [ "$output" != "$lines"$'\n'"$lines" ]; then
+  echo "test failed - files-with-matches b"
+fi
+
+build/Debug/grep -m 0 -e 'a' "$lines" # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - max-count 0 a"
+fi
+rm -f "$lines"
+
+output=$(printf 'x\nab1 ab22\n' | build/Debug/grep -o -n -b -e '[0-9]+')
+if [ "$output" != $'2:4:1\n2:8:22' ]; then
+  echo "test failed - only-matching line-number byte-offset [0-9]+"
+fi
+
+output=$(printf 'abab\n' | build/Debug/grep -o -e '(ab|a)\1')
+if [ "$output" != "abab" ]; then
+  echo "test failed - only-matching (ab|a)\\1"
+fi
+
+echo -n 'Hello World' | build/Debug/grep -i -E 'hello [a-z]orld' # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - ignore-case hello [a-z]orld"
+fi
+
+echo -n 'abcABC' | build/Debug/grep -i -E '(abc)\1' # 0
+if [ $? -ne 0 ]; then
+  echo "test failed - ignore-case (abc)\\1"
+fi
+
+echo -n 'A' | build/Debug/grep -i -E '[^a]' # 1
+if [ $? -ne 1 ]; then
+  echo "test failed - ignore-case [^a]"
+fi
+
+output=$(printf '1\n2 x\n3\n4\n5\n6 x\n7\n' | build/Debug/grep -n -A 1 -B1 -e 'x' /dev/stdin)
+if [ "$output" != $'1-1\n2:2 x\n3-3\n--\n5-5\n6:6 x\n7-7' ]; then
+  echo "test failed - context x"
+fi
+
+output=$(printf 'x\ny\nx\n' | build/Debug/grep -C0 -e 'x')
+if [ "$output" != $'x\n--\nx' ]; then
+  echo "test failed - context 0 x"
+fi
+
+output=$(printf 'x\nfoo\n' | build/Debug/grep -e 'foo') # 0
+if [ $? -ne 0 ] || [ "$output" != "foo" ]; then
+  echo "test failed - stdin foo"
+fi
+
+output=$(printf 'foo\nfoo\nbar\n' | build/Debug/grep -c -e 'foo')
+if [ "$output" != "2" ]; then
+  echo "test failed - stdin count foo"
+fi
+
+output=$(printf 'foo\nfoo\nbar\n' | build/Debug/grep -m 1 -n -e 'foo')
+if [ "$output" != "1:foo" ]; then
+  echo "test failed - stdin max-count line-number foo"
+fi
+
+output=$(printf 'bar\nfoo\n' | build/Debug/grep -q -e 'foo') # 0
+if [ $? -ne 0 ] || [ -n "$output" ]; then
+  echo "test failed - stdin quiet foo"
+fi
+
+output=$(printf 'bar\nfoo\n' | build/Debug/grep -l -e 'foo')
+if [ "$output" != "(standard input)" ]; then
+  echo "test failed - stdin files-with-matches foo"
+fi
+
+output=$(printf 'a\nb x\n' | gzip | build/Debug/grep -n -e 'x')
+if [ "$output" != "2:b x" ]; then
+  echo "test failed - gzip stream x"
+fi
+
+output=$(printf 'a\nb x\nc x\n' | gzip | zcat | build/Debug/grep -c -e 'x')
+if [ "$output" != "2" ]; then
+  echo "test failed - zcat stream x"
+fi
+
+error=$(echo -n 'foo' | build/Debug/grep -v -e 'foo' 2>&1) # 2
+if [ $? -ne 2 ] || [ "$error" != "Unknown option '-v'" ]; then
+  echo "test failed - unknown option -v"
+fi
+
+lines=$(mktemp)
+echo 'foo' > "$lines"
+output=$(build/Debug/grep -e 'foo' /nonexistent "$lines" 2>&1) # 2
+if [ $? -ne 2 ] || [ "$output" != "grep: /nonexistent: No such file or directory"$'\n'"$lines:foo" ]; then
+  echo "test failed - missing file foo"
+fi
+rm -f "$lines"
+
+truncated=$(mktemp)
+seq 10000 | gzip | head -c 1000 > "$truncated"
+error=$(build/Debug/grep -e '1' "$truncated" 2>&1 >/dev/null) # 2
+if [ $? -ne 2 ] || [ "$error" != "grep: $truncated: corrupt or truncated compressed data" ]; then
+  echo "test failed - truncated gzip 1"
+fi
+rm -f "$truncated"
+
+output=$( (printf 'a\nb x\n' | gzip; head -c 512 /dev/zero) | build/Debug/grep -c -e 'x' 2>&1) # 0
+if [ $? -ne 0 ] || [ "$output" != "1" ]; then
+  echo "test failed - padded gzip x"
+fi